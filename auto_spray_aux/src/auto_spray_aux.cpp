@@ -1,56 +1,202 @@
 #include <Arduino.h>
 #include <OneWire.h>
-#include <DallasTemperature.h>
 #include <Wire.h>
+#include <EEPROM.h>
+#include <SprayLink.h>
 
 // Declare variables ---------------------------------------------------
 
+/*
+EEPROM, last validated settings from host
+address 0 = cache version
+address 1 = payload length
+address 2.. = link_settings
+address 2+len = CRC8 over address 0..1+len, 3+len bytes in all
+
+EEPROM, last complete schedule from host
+address 64 = cache version
+address 65 = slot count
+address 66.. = link_slot table
+address 66+count*10 = CRC8 over address 64..65+count*10
+*/
+
 #define HOST_ADDRESS 0x01
+#define FW_VERSION 1
+#define LINK_TIMEOUT 30000 // ms without a valid frame before going degraded, 3 host heartbeats
+#define CACHE_VERSION 8
+#define CACHE_ADDRESS 0
+#define SCHEDULE_ADDRESS 64
+#define CACHE_DELAY 5000 // ms settings must be stable before they are written, menu edits come in bursts
+#define SERIAL_BAUD 115200
+#define DEBUG_INTERVAL 5000 // ms between debug dumps, one dump fills the TX buffer several times over
+#ifndef AUX_DEBUG
+#define AUX_DEBUG 0 // the dump blocks loop() for about 25 ms per DEBUG_INTERVAL, build env "debug" turns it on
+#endif
 
 struct temperature_set
 {
-  float threshold, celcius;
+  int16_t threshold, celcius; // centi C
 } temperature;
 
-struct timer_set
-{
-  byte hour, minute, setting;
-} timer1, timer2, timer3;
-
 struct RTC_now
 {
-  byte minute, hour;
+  byte second, minute, hour, dayOfWeek, dayOfMonth, month, year;
 } RTC;
 
+static_assert(sizeof(RTC_now) == sizeof(link_time), "RTC_now must match the link time frame");
+
 struct device_settings
 {
   byte duration; // spray duration
 } deviceSet;
 
-unsigned long time_now, counter_loop = 0;
-int valve1, valve2, queue, indx = 0;
-char buffer[16];
+struct temp_conversion
+{
+  bool pending;
+  bool reset;                  // a sensor lost its configuration, rewrite it before the next conversion
+  byte next;                   // next sensor to collect
+  unsigned long started, wait; // conversion start and DS18B20 conversion time
+} conversion;
+
+unsigned long counter_loop = 0, counter_debugging = 0;
+unsigned long tempChanged = 0; // millis() the temperature valve last opened or closed
+volatile unsigned long counter_clock = 0; // millis() of the last RTC second, reset by time frames
+volatile unsigned long lastFrame = 0;     // millis() of the last valid frame, written from the TWI interrupt
+volatile unsigned long settingsChanged = 0;
+volatile bool settingsDirty = false;
+link_slot schedule[LINK_MAX_SLOTS];   // sorted by start minute
+link_slot scheduleRx[LINK_MAX_SLOTS]; // schedule chunks land here until the table is complete
+byte scheduleCount = 0;
+volatile byte scheduleRxCount = 0;
+link_schedule_rx scheduleRxState = {0, 0, 0}; // chunks of scheduleRx that arrived, only touched by receiveEvent()
+volatile bool scheduleStaged = false; // scheduleRx holds a complete table, swapped in by applySchedule()
+volatile bool timeValid = false;      // a time frame arrived since boot, RTC is not just counting from 00:00
+link_schedule_cursor scheduleCursor = {0, false};
+bool scheduleDirty = false;
+unsigned long scheduleChanged = 0;
+byte lastSeq = 0;
+bool seqValid = false;
+link_registers regs; // register map served to host, regs.settings holds the last settings received
+link_pointer regPointer = {LINK_REG(status), sizeof(link_status)};
+byte trigger = LINK_TRIGGER_NONE;
+byte sensorError = LINK_SENSOR_OK;
+byte rxFrame[LINK_MAX_FRAME];
+byte txSeq = 0;
+
+const int relay1 = 4; // main valve
+const int relay2 = 7; // temperature line
+const int relay3 = 8; // timer line
+
+#define RELAY_MAIN 0x01
+#define RELAY_TEMP 0x02
+#define RELAY_TIMER 0x04
+
+struct valve_profile
+{
+  byte line;                         // relay mask of the line feeding this valve
+  unsigned int settle, prime, drain; // ms, all off -> line on -> main on, main off -> line off
+};
+
+valve_profile tempProfile = {RELAY_TEMP, 100, 500, 500};
+valve_profile timerProfile = {RELAY_TIMER, 100, 500, 500};
+
+struct spray_job
+{
+  byte source;            // link_trigger, LINK_TRIGGER_NONE = no job
+  byte priority;          // higher runs first
+  uint16_t duration;      // s, 0 = as long as the temperature stays over the threshold
+  unsigned long deadline; // millis() a waiting job is dropped at
+  bool expires;           // temperature jobs never expire, they are dropped once it cools down
+};
+
+spray_job jobs[LINK_MAX_JOBS]; // waiting, highest priority first, FIFO within a priority
+byte jobCount = 0;
+byte jobsDropped = 0;
+spray_job active = {LINK_TRIGGER_NONE}; // job holding the valves
+unsigned long activeStarted = 0;
 
-const int relay1 = 4;
-const int relay2 = 7;
-const int relay3 = 8;
+struct relay_step
+{
+  byte relays;       // relay mask to apply
+  unsigned int hold; // ms before the next step
+};
+
+struct relay_sequencer
+{
+  relay_step steps[3];
+  byte count, index;
+  unsigned long started; // time the current step was applied
+} relaySeq;
 
 const int oneWireBus = 2; // GPIO DS18B20 (Temp sensor)
 OneWire oneWire(oneWireBus);
-DallasTemperature sensors(&oneWire);
 
-union floatToBytes
+#define DS18B20_FAMILY 0x28
+#define DS18B20_CONVERT 0x44
+#define DS18B20_WRITE_SCRATCHPAD 0x4E
+#define DS18B20_READ_SCRATCHPAD 0xBE
+#define DS18B20_READ_POWER 0xB4
+#define DS18B20_POWER_ON 0x0550 // 85.00 C, the temperature register before the first conversion
+#define SENSOR_RETRY 2000 // ms between bus searches while no sensor is found
+#define SENSOR_RESET 0xFF // readScratchpad(): the sensor lost its configuration, not a link_sensor code
+
+const unsigned int conversionTime[4] = {94, 188, 375, 750}; // ms at 9, 10, 11, 12 bit
+
+struct ds18b20
 {
-  char text[4];
-  float value;
-} fl2b;
+  byte rom[8];
+  int16_t celcius; // centi C, filtered
+  int32_t ema;     // filter state, centi C * 16
+  byte error;      // link_sensor
+} sensors[LINK_MAX_SENSORS];
+
+byte sensorCount = 0;
+byte resolution = 0; // bits currently written to the sensors, 0 = not configured
+bool parasite = false;
 
 // Declare functions ---------------------------------------------------
 
 unsigned long minuteToMillis(unsigned long minute);
 unsigned long hourToMillis(unsigned long hour);
+unsigned long secondToMillis(unsigned long second);
+void tickClock();
+void applySettings();
+void takeSettings(const link_settings *settings);
+bool loadSettings();
+void saveSettings();
+void applySchedule();
+bool loadSchedule();
+void saveSchedule();
 void receiveSettings();
 void sendStatus();
+void updateRegisters();
+void failsafe();
+void checkLink();
+byte findSensors();
+void setResolution(byte bits);
+void startConversion();
+byte readScratchpad(const byte *rom, int16_t *raw);
+void filterTemp(ds18b20 *sensor, int16_t centi);
+void combineTemp();
+void readTemp();
+void writeRelays(byte relays);
+void runStep();
+void openValve(const valve_profile *profile);
+void closeValve(const valve_profile *profile);
+bool relayBusy();
+void updateRelays();
+bool tempJob(byte source);
+const valve_profile *jobProfile(byte source);
+byte jobPriority(byte source);
+unsigned long jobElapsed();
+int findJob(bool temp);
+void dropJob(byte index);
+void queueJob(const spray_job *job);
+void addJob(byte source, uint16_t duration);
+void startJob();
+void finishJob();
+void runJobs();
+byte tempTrigger(int16_t limit);
 void checkTemp();
 void checkTime();
 void debugging();
@@ -67,162 +213,893 @@ unsigned long hourToMillis(unsigned long hour)
   return hour * 60 * 60 * 1000;
 }
 
+unsigned long secondToMillis(unsigned long second)
+{
+  return second * 1000;
+}
+
+void tickClock()
+{ // keep RTC running between time frames and while the host is away
+  noInterrupts();
+  while (millis() - counter_clock >= 1000)
+  {
+    counter_clock += 1000;
+    if (++RTC.second < 60)
+    {
+      continue;
+    }
+    RTC.second = 0;
+    if (++RTC.minute < 60)
+    {
+      continue;
+    }
+    RTC.minute = 0;
+    if (++RTC.hour < 24)
+    {
+      continue;
+    }
+    RTC.hour = 0;
+    RTC.dayOfWeek = (RTC.dayOfWeek % 7) + 1;
+    if (++RTC.dayOfMonth > linkDaysInMonth(RTC.month, RTC.year))
+    {
+      RTC.dayOfMonth = 1;
+      if (++RTC.month > 12)
+      {
+        RTC.month = 1;
+        RTC.year = (RTC.year + 1) % 100;
+      }
+    }
+  }
+  interrupts();
+}
+
 // I2C Comms ----------------------------------------------------------------
 
+void applySettings()
+{
+  temperature.threshold = regs.settings.threshold;
+  deviceSet.duration = regs.settings.duration;
+}
+
+void takeSettings(const link_settings *settings)
+{ // the heartbeat repeats the settings in use, only a real change is applied and cached
+  if (memcmp(&regs.settings, settings, sizeof(regs.settings)) == 0)
+  {
+    return;
+  }
+  memcpy(&regs.settings, settings, sizeof(regs.settings));
+  applySettings();
+  settingsDirty = true;
+  settingsChanged = millis();
+}
+
+bool loadSettings()
+{ // restore the cached frame, false if it is missing, from another layout or corrupt
+  byte cache[2 + sizeof(link_settings) + 1];
+  for (byte i = 0; i < sizeof(cache); i++)
+  {
+    cache[i] = EEPROM.read(CACHE_ADDRESS + i);
+  }
+  if (cache[0] != CACHE_VERSION || cache[1] != sizeof(link_settings) || linkCrc8(cache, sizeof(cache) - 1) != cache[sizeof(cache) - 1])
+  {
+    return false;
+  }
+  memcpy(&regs.settings, cache + 2, sizeof(link_settings));
+  applySettings();
+  return true;
+}
+
+void saveSettings()
+{ // EEPROM.update() only writes bytes that differ
+  if (!settingsDirty || millis() - settingsChanged < CACHE_DELAY)
+  {
+    return;
+  }
+  byte cache[2 + sizeof(link_settings) + 1];
+  noInterrupts();
+  memcpy(cache + 2, &regs.settings, sizeof(link_settings));
+  settingsDirty = false;
+  interrupts();
+  cache[0] = CACHE_VERSION;
+  cache[1] = sizeof(link_settings);
+  cache[sizeof(cache) - 1] = linkCrc8(cache, sizeof(cache) - 1);
+  for (byte i = 0; i < sizeof(cache); i++)
+  {
+    EEPROM.update(CACHE_ADDRESS + i, cache[i]);
+  }
+}
+
+void applySchedule()
+{ // swap the table in outside the interrupt, checkTime() never sees half of an update
+  if (!scheduleStaged)
+  {
+    return;
+  }
+  noInterrupts();
+  scheduleCount = scheduleRxCount;
+  memcpy(schedule, scheduleRx, scheduleCount * sizeof(link_slot));
+  scheduleStaged = false;
+  interrupts();
+  linkScheduleSort(schedule, scheduleCount);
+  scheduleDirty = true;
+  scheduleChanged = millis();
+}
+
+bool loadSchedule()
+{ // same checks as loadSettings(), a bad cache leaves the table empty
+  byte cache[2 + LINK_MAX_SLOTS * sizeof(link_slot) + 1];
+  cache[0] = EEPROM.read(SCHEDULE_ADDRESS);
+  cache[1] = EEPROM.read(SCHEDULE_ADDRESS + 1);
+  if (cache[0] != CACHE_VERSION || cache[1] > LINK_MAX_SLOTS)
+  {
+    return false;
+  }
+  byte size = 2 + cache[1] * sizeof(link_slot);
+  for (byte i = 2; i <= size; i++)
+  {
+    cache[i] = EEPROM.read(SCHEDULE_ADDRESS + i);
+  }
+  if (linkCrc8(cache, size) != cache[size])
+  {
+    return false;
+  }
+  scheduleCount = cache[1];
+  memcpy(schedule, cache + 2, scheduleCount * sizeof(link_slot));
+  linkScheduleSort(schedule, scheduleCount);
+  return true;
+}
+
+void saveSchedule()
+{
+  if (!scheduleDirty || millis() - scheduleChanged < CACHE_DELAY)
+  {
+    return;
+  }
+  byte cache[2 + LINK_MAX_SLOTS * sizeof(link_slot) + 1];
+  byte size = 2 + scheduleCount * sizeof(link_slot);
+  cache[0] = CACHE_VERSION;
+  cache[1] = scheduleCount;
+  memcpy(cache + 2, schedule, scheduleCount * sizeof(link_slot));
+  cache[size] = linkCrc8(cache, size);
+  for (byte i = 0; i <= size; i++)
+  {
+    EEPROM.update(SCHEDULE_ADDRESS + i, cache[i]);
+  }
+  scheduleDirty = false;
+}
+
 void receiveSettings(int n)
-{ // Recieve settings from host per 30 sec and initial setup
+{ // Recieve framed settings/time from host, anything that doesn't validate is dropped
+  byte count = 0;
   while (Wire.available())
   {
-    buffer[indx] = Wire.read();
-    indx++;
+    byte data = Wire.read();
+    if (count < sizeof(rxFrame))
+    {
+      rxFrame[count] = data;
+    }
+    count++;
+  }
+  link_frame frame;
+  if (linkParse(rxFrame, count, &frame) != LINK_OK)
+  {
+    regs.health.rejected++;
+    return;
+  }
+  byte gap = frame.seq - lastSeq - 1;
+  if (seqValid && gap < 128)
+  { // a larger jump backwards means the host restarted its counter
+    regs.health.missed += gap;
+  }
+  lastSeq = frame.seq;
+  seqValid = true;
+  const link_settings *settings = linkPayload<link_settings>(&frame, LINK_MSG_SETTINGS);
+  const link_time *now = linkPayload<link_time>(&frame, LINK_MSG_TIME);
+  const link_pointer *pointer = linkPayload<link_pointer>(&frame, LINK_MSG_POINTER);
+  byte complete = 0xFF;
+  link_settings delta = regs.settings;
+  if (settings != NULL)
+  {
+    takeSettings(settings);
+  }
+  else if (frame.type == LINK_MSG_DELTA && linkApplyDelta(&delta, frame.payload, frame.len))
+  {
+    takeSettings(&delta);
+  }
+  else if (now != NULL)
+  {
+    memcpy(&RTC, now, sizeof(RTC));
+    counter_clock = millis();
+    timeValid = true;
   }
-  indx = 0;
-  for (int i = 0; i < 4; i++)
+  else if (pointer != NULL && linkPointerValid(pointer))
   {
-    fl2b.text[i] = buffer[i];
+    regPointer = *pointer;
   }
-  temperature.threshold = fl2b.value;
-  RTC.hour = buffer[4];
-  RTC.minute = buffer[5];
-  deviceSet.duration = buffer[6];
-  timer1.hour = buffer[7];
-  timer1.minute = buffer[8];
-  timer1.setting = buffer[9];
-  timer2.hour = buffer[10];
-  timer2.minute = buffer[11];
-  timer2.setting = buffer[12];
-  timer3.hour = buffer[13];
-  timer3.minute = buffer[14];
-  timer3.setting = buffer[15];
+  else if (frame.type == LINK_MSG_SCHEDULE && !scheduleStaged && linkApplySchedule(&scheduleRxState, scheduleRx, &complete, frame.payload, frame.len))
+  { // while a table waits for applySchedule() further chunks are dropped, the next heartbeat sees the mismatch
+    if (complete != 0xFF)
+    {
+      scheduleRxCount = complete;
+      scheduleStaged = true;
+    }
+  }
+  else
+  {
+    regs.health.rejected++;
+    return;
+  }
+  regs.health.received++;
+  lastFrame = millis();
 }
 
 void sendStatus()
-{ // Send temp status, prolly...
-  fl2b.value = temperature.celcius;
-  Wire.write(fl2b.text, 4);
+{ // Send the register window selected by the last pointer frame
+  byte payload[LINK_MAX_PAYLOAD];
+  byte frame[LINK_MAX_FRAME];
+  payload[0] = regPointer.reg;
+  memcpy(payload + 1, (byte *)&regs + regPointer.reg, regPointer.len);
+  Wire.write(frame, linkPack(frame, LINK_MSG_REGISTERS, txSeq++, payload, regPointer.len + 1));
 }
 
-// Main function ------------------------------------------------------------
+void updateRegisters()
+{ // sendStatus() runs from the TWI interrupt, build the record first and publish it atomically
+  link_status status;
+  link_zones zones;
+  link_queue waiting;
+  zones.count = sensorCount;
+  for (byte i = 0; i < LINK_MAX_SENSORS; i++)
+  {
+    zones.celcius[i] = (i < sensorCount) ? sensors[i].celcius : LINK_TEMP_INVALID;
+  }
+  status.faults = (sensorError != LINK_SENSOR_OK) ? LINK_FAULT_SENSOR : 0;
+  if (regs.health.state == LINK_STATE_DEGRADED)
+  {
+    status.faults |= LINK_FAULT_LINK;
+  }
+  status.celcius = temperature.celcius;
+  status.valves = (jobCount > 0 ? LINK_VALVE_QUEUE : 0) | (relayBusy() ? LINK_VALVE_BUSY : 0);
+  if (active.source != LINK_TRIGGER_NONE)
+  {
+    status.valves |= tempJob(active.source) ? LINK_VALVE_TEMP : LINK_VALVE_TIMER;
+  }
+  status.remaining = 0;
+  if (active.duration > 0 && jobElapsed() < active.duration)
+  {
+    status.remaining = active.duration - jobElapsed();
+  }
+  status.trigger = trigger;
+  waiting.count = jobCount;
+  waiting.dropped = jobsDropped;
+  memset(waiting.jobs, 0, sizeof(waiting.jobs));
+  for (byte i = 0; i < jobCount; i++)
+  {
+    unsigned long left = 0xFF;
+    if (jobs[i].expires)
+    { // a passed deadline reads 0 until runJobs() drops the job, not an unsigned wrap
+      left = ((long)(millis() - jobs[i].deadline) >= 0) ? 0 : (jobs[i].deadline - millis()) / 60000;
+    }
+    waiting.jobs[i] = {jobs[i].source, jobs[i].priority, jobs[i].duration, (byte)(left > 0xFE && jobs[i].expires ? 0xFE : left)};
+  }
+  status.sensorError = sensorError;
+  status.uptime = millis() / 1000;
+  link_table table = {scheduleCount, linkScheduleCrc(schedule, scheduleCount)};
+  noInterrupts();
+  regs.status = status;
+  regs.zones = zones;
+  regs.queue = waiting;
+  regs.schedule = table;
+  interrupts();
+}
 
-void checkTemp()
+void failsafe()
+{ // host went silent, its last settings may be stale: finish any spray in progress cleanly
+  if (active.source != LINK_TRIGGER_NONE)
+  { // ignores the minimum on time, a stale threshold is worse than a short spray
+    finishJob();
+  }
+  jobCount = 0;
+}
+
+void checkLink()
+{ // degraded mode keeps control running on the last settings and the local clock
+  noInterrupts();
+  unsigned long age = millis() - lastFrame;
+  interrupts();
+  if (regs.health.state == LINK_STATE_OK && age >= LINK_TIMEOUT)
+  {
+    regs.health.state = LINK_STATE_DEGRADED;
+    regs.health.outages++;
+    failsafe();
+  }
+  else if (regs.health.state == LINK_STATE_DEGRADED && age < LINK_TIMEOUT)
+  {
+    regs.health.state = LINK_STATE_OK;
+  }
+  age /= 1000;
+  noInterrupts();
+  regs.health.age = age > 0xFFFF ? 0xFFFF : age;
+  interrupts();
+}
+
+// Temp sensor --------------------------------------------------------------
+
+byte findSensors()
+{ // cache the ROM of every DS18B20 on the bus, no search on every read afterwards
+  byte rom[8];
+  sensorCount = 0;
+  parasite = false;
+  oneWire.reset_search();
+  while (sensorCount < LINK_MAX_SENSORS && oneWire.search(rom))
+  {
+    if (rom[0] != DS18B20_FAMILY || OneWire::crc8(rom, 7) != rom[7])
+    {
+      continue;
+    }
+    memcpy(sensors[sensorCount].rom, rom, sizeof(rom));
+    sensors[sensorCount].celcius = LINK_TEMP_INVALID;
+    oneWire.reset();
+    oneWire.select(rom);
+    oneWire.write(DS18B20_READ_POWER);
+    if (oneWire.read_bit() == 0)
+    {
+      parasite = true;
+    }
+    sensorCount++;
+  }
+  resolution = 0;
+  return sensorCount;
+}
+
+void setResolution(byte bits)
+{ // config register bits 5-6 = resolution - 9, alarm bytes are unused, skip ROM sets every sensor
+  oneWire.reset();
+  oneWire.skip();
+  oneWire.write(DS18B20_WRITE_SCRATCHPAD);
+  oneWire.write(0);
+  oneWire.write(0);
+  oneWire.write(((bits - 9) << 5) | 0x1F);
+  resolution = bits;
+  conversion.wait = conversionTime[bits - 9];
+}
+
+void startConversion()
+{ // one skip ROM convert for all sensors, the scratchpads are collected by readTemp()
+  byte bits = regs.settings.resolution;
+  if (bits < 9 || bits > 12)
+  {
+    bits = 12;
+  }
+  if (resolution != bits || conversion.reset)
+  {
+    setResolution(bits);
+    conversion.reset = false;
+  }
+  oneWire.reset();
+  oneWire.skip();
+  oneWire.write(DS18B20_CONVERT, parasite); // parasite power needs the strong pullup held
+  conversion.started = millis();
+  conversion.pending = true;
+  conversion.next = 0;
+}
+
+byte readScratchpad(const byte *rom, int16_t *raw)
+{ // raw in 1/16 C, returns a link_sensor code
+  byte data[9];
+  if (!oneWire.reset())
+  {
+    return LINK_SENSOR_DISCONNECTED;
+  }
+  oneWire.select(rom);
+  oneWire.write(DS18B20_READ_SCRATCHPAD);
+  oneWire.read_bytes(data, sizeof(data));
+  if (OneWire::crc8(data, 8) != data[8] || (data[4] & 0x1F) != 0x1F)
+  { // config register low bits always read 1, catches an all zero scratchpad that passes the CRC
+    return LINK_SENSOR_CRC;
+  }
+  *raw = (data[1] << 8) | data[0];
+  if (((data[4] >> 5) & 0x03) != resolution - 9 || *raw == DS18B20_POWER_ON)
+  { // a power glitch puts the sensor back to 12 bit and 85.00 C, the short wait read an unfinished conversion
+    return SENSOR_RESET;
+  }
+  *raw &= ~((1 << (12 - resolution)) - 1); // undefined low bits below 12 bit
+  return LINK_SENSOR_OK;
+}
+
+void filterTemp(ds18b20 *sensor, int16_t centi)
+{ // fixed point EMA, 4 extra fraction bits so steps smaller than 1/2^filter still move the state
+  byte shift = regs.settings.filter > LINK_FILTER_MAX ? LINK_FILTER_MAX : regs.settings.filter;
+  int32_t sample = (int32_t)centi * 16;
+  if (sensor->celcius == LINK_TEMP_INVALID || shift == 0)
+  { // first reading after boot or a fault seeds the filter
+    sensor->ema = sample;
+  }
+  else
+  {
+    sensor->ema += (sample - sensor->ema) / (1 << shift);
+  }
+  sensor->celcius = (sensor->ema + (sensor->ema < 0 ? -8 : 8)) / 16;
+}
+
+void combineTemp()
+{ // control temperature from the MAX and AVERAGE sensors, ZONE sensors are checked on their own
+  int16_t highest = LINK_TEMP_INVALID;
+  int32_t sum = 0;
+  byte count = 0;
+  sensorError = LINK_SENSOR_OK;
+  for (byte i = 0; i < sensorCount; i++)
+  {
+    if (sensors[i].error != LINK_SENSOR_OK)
+    {
+      if (sensorError == LINK_SENSOR_OK)
+      {
+        sensorError = sensors[i].error;
+      }
+      continue;
+    }
+    byte role = LINK_ROLE(regs.settings.roles, i);
+    if (role == LINK_ROLE_MAX && sensors[i].celcius > highest)
+    {
+      highest = sensors[i].celcius;
+    }
+    if (role == LINK_ROLE_AVERAGE)
+    {
+      sum += sensors[i].celcius;
+      count++;
+    }
+  }
+  if (count > 0 && sum / count > highest)
+  {
+    highest = sum / count;
+  }
+  temperature.celcius = highest;
+}
+
+void readTemp()
+{ // called every loop pass, one sensor read per pass once the conversion time has elapsed
+  if (sensorCount == 0)
+  {
+    if (millis() - conversion.started < SENSOR_RETRY)
+    {
+      return;
+    }
+    conversion.started = millis();
+    if (findSensors() == 0)
+    {
+      return;
+    }
+    conversion.pending = false;
+  }
+  if (!conversion.pending)
+  {
+    startConversion();
+    return;
+  }
+  if (millis() - conversion.started < conversion.wait)
+  {
+    return;
+  }
+  ds18b20 *sensor = &sensors[conversion.next];
+  int16_t raw;
+  byte error = readScratchpad(sensor->rom, &raw);
+  if (error == SENSOR_RESET)
+  { // sample dropped, the last reading stands and the next conversion rewrites the resolution
+    conversion.reset = true;
+  }
+  else if (error == LINK_SENSOR_OK)
+  {
+    sensor->error = error;
+    filterTemp(sensor, (int32_t)raw * 25 / 4);
+  }
+  else
+  {
+    sensor->error = error;
+    sensor->celcius = LINK_TEMP_INVALID;
+  }
+  if (++conversion.next < sensorCount)
+  {
+    return;
+  }
+  combineTemp();
+  startConversion();
+}
+
+// Relay sequencer ----------------------------------------------------------
+
+void writeRelays(byte relays)
+{
+  digitalWrite(relay1, (relays & RELAY_MAIN) ? HIGH : LOW);
+  digitalWrite(relay2, (relays & RELAY_TEMP) ? HIGH : LOW);
+  digitalWrite(relay3, (relays & RELAY_TIMER) ? HIGH : LOW);
+}
+
+void runStep()
+{
+  writeRelays(relaySeq.steps[relaySeq.index].relays);
+  relaySeq.started = millis();
+}
+
+void openValve(const valve_profile *profile)
+{
+  relaySeq.steps[0] = {0, profile->settle};
+  relaySeq.steps[1] = {profile->line, profile->prime};
+  relaySeq.steps[2] = {(byte)(profile->line | RELAY_MAIN), 0};
+  relaySeq.count = 3;
+  relaySeq.index = 0;
+  runStep();
+}
+
+void closeValve(const valve_profile *profile)
+{
+  relaySeq.steps[0] = {profile->line, profile->drain};
+  relaySeq.steps[1] = {0, 0};
+  relaySeq.count = 2;
+  relaySeq.index = 0;
+  runStep();
+}
+
+bool relayBusy()
 {
-  sensors.requestTemperatures();
-  temperature.celcius = sensors.getTempCByIndex(0);
-  if (temperature.celcius >= temperature.threshold && valve1 == 0 && valve2 == 0 && queue == 0)
+  return relaySeq.index < relaySeq.count;
+}
+
+void updateRelays()
+{ // called every loop pass, advances the running sequence without blocking
+  if (!relayBusy() || millis() - relaySeq.started < relaySeq.steps[relaySeq.index].hold)
   {
-    digitalWrite(relay1, LOW);
-    digitalWrite(relay2, LOW);
-    digitalWrite(relay3, LOW);
-    delay(100);
-    digitalWrite(relay2, HIGH);
-    delay(500);
-    digitalWrite(relay1, HIGH);
-    valve1 = 1;
+    return;
   }
-  if (valve1 == 1 && temperature.celcius < temperature.threshold && valve2 == 0)
+  relaySeq.index++;
+  if (relayBusy())
   {
-    digitalWrite(relay1, LOW);
-    delay(500);
-    digitalWrite(relay2, LOW);
-    valve1 = 0;
+    runStep();
   }
 }
 
-void checkTime()
+// Spray jobs --------------------------------------------------------------
+
+bool tempJob(byte source)
+{ // TEMP and ZONE jobs share the temperature line
+  return source >= LINK_TRIGGER_TEMP && source < LINK_TRIGGER_SLOT1;
+}
+
+const valve_profile *jobProfile(byte source)
+{
+  return tempJob(source) ? &tempProfile : &timerProfile;
+}
+
+byte jobPriority(byte source)
 {
-  if (RTC.hour == timer1.hour && RTC.minute == timer1.minute && timer1.setting == 1 && queue == 0)
+  bool timerFirst = regs.settings.policy & LINK_POLICY_TIMER_FIRST;
+  return (tempJob(source) != timerFirst) ? 2 : 1;
+}
+
+unsigned long jobElapsed()
+{ // s the active job has run
+  return (millis() - activeStarted) / 1000;
+}
+
+int findJob(bool temp)
+{ // first waiting job on the temperature or the timer line, -1 if none
+  for (byte i = 0; i < jobCount; i++)
   {
-    queue = 1;
+    if (tempJob(jobs[i].source) == temp)
+    {
+      return i;
+    }
   }
-  if (RTC.hour == timer2.hour && RTC.minute == timer2.minute && timer2.setting == 1 && queue == 0)
+  return -1;
+}
+
+void dropJob(byte index)
+{
+  jobCount--;
+  memmove(&jobs[index], &jobs[index + 1], (jobCount - index) * sizeof(spray_job));
+}
+
+void queueJob(const spray_job *job)
+{ // insert behind every job of the same or higher priority, a full queue loses its lowest job
+  if (jobCount == LINK_MAX_JOBS)
   {
-    queue = 1;
+    jobsDropped++;
+    if (jobs[jobCount - 1].priority >= job->priority)
+    {
+      return;
+    }
+    jobCount--;
   }
-  if (RTC.hour == timer3.hour && RTC.minute == timer3.minute && timer3.setting == 1 && queue == 0)
+  byte i = jobCount;
+  while (i > 0 && jobs[i - 1].priority < job->priority)
   {
-    queue = 1;
+    jobs[i] = jobs[i - 1];
+    i--;
   }
-  if (queue == 1 && valve1 == 0 && valve2 == 0)
+  jobs[i] = *job;
+  jobCount++;
+}
+
+void addJob(byte source, uint16_t duration)
+{ // apply the merge/preempt/defer policy to a new spray request
+  bool temp = tempJob(source);
+  spray_job job = {source, jobPriority(source), duration, millis() + minuteToMillis(regs.settings.deadline), !temp && regs.settings.deadline > 0};
+  if ((regs.settings.policy & LINK_POLICY_MERGE) && !temp)
   {
-    time_now = millis();
-    digitalWrite(relay1, LOW);
-    digitalWrite(relay2, LOW);
-    digitalWrite(relay3, LOW);
-    delay(100);
-    digitalWrite(relay3, HIGH);
-    delay(500);
-    digitalWrite(relay1, HIGH);
-    valve2 = 1;
+    if (active.source != LINK_TRIGGER_NONE && !tempJob(active.source))
+    { // running timer spray runs on until the new job would have ended
+      unsigned long end = jobElapsed() + duration;
+      active.duration = max(active.duration, (uint16_t)min(end, 0xFFFFUL));
+      trigger = source;
+      return;
+    }
+    int waiting = findJob(false);
+    if (waiting >= 0)
+    {
+      jobs[waiting].duration = max(jobs[waiting].duration, duration);
+      jobs[waiting].deadline = job.deadline;
+      jobs[waiting].expires = job.expires;
+      return;
+    }
+  }
+  if ((regs.settings.policy & LINK_POLICY_PREEMPT) && active.source != LINK_TRIGGER_NONE && job.priority > active.priority)
+  { // a timed job goes back in line with what it had left, a temperature job is raised again by checkTemp()
+    spray_job rest = active;
+    bool requeue = rest.duration > 0 && jobElapsed() < rest.duration;
+    rest.duration -= requeue ? jobElapsed() : 0;
+    rest.deadline = job.deadline;
+    rest.expires = regs.settings.deadline > 0;
+    finishJob();
+    if (requeue)
+    {
+      queueJob(&rest);
+    }
   }
-  if (valve1 == 0 && valve2 == 1 && millis() - time_now >= minuteToMillis(deviceSet.duration))
+  queueJob(&job);
+}
+
+void startJob()
+{
+  active = jobs[0];
+  dropJob(0);
+  activeStarted = millis();
+  trigger = active.source;
+  openValve(jobProfile(active.source));
+  if (tempJob(active.source))
   {
-    digitalWrite(relay1, LOW);
-    delay(500);
-    digitalWrite(relay3, LOW);
-    valve2 = 0;
-    queue = 0;
+    tempChanged = millis();
   }
 }
 
-void debugging()
+void finishJob()
 {
-  Serial.println(sensors.getTempCByIndex(0));
-  Serial.print("RTC: ");
+  closeValve(jobProfile(active.source));
+  if (tempJob(active.source))
+  {
+    tempChanged = millis();
+  }
+  active.source = LINK_TRIGGER_NONE;
+}
+
+void runJobs()
+{ // one job holds the main valve at a time, the next starts once the relays are idle
+  if (relayBusy())
+  {
+    return;
+  }
+  if (active.source != LINK_TRIGGER_NONE)
+  {
+    if (active.duration > 0 && jobElapsed() >= active.duration)
+    {
+      finishJob();
+    }
+    return;
+  }
+  for (byte i = jobCount; i > 0; i--)
+  {
+    if (jobs[i - 1].expires && (long)(millis() - jobs[i - 1].deadline) >= 0)
+    {
+      dropJob(i - 1);
+      jobsDropped++;
+    }
+  }
+  if (jobCount > 0)
+  {
+    startJob();
+  }
+}
+
+// Main function ------------------------------------------------------------
+
+byte tempTrigger(int16_t limit)
+{ // what is over the limit: the MAX/AVERAGE group, else the first ZONE sensor
+  if (temperature.celcius >= limit)
+  {
+    return LINK_TRIGGER_TEMP;
+  }
+  for (byte i = 0; i < sensorCount; i++)
+  {
+    if (LINK_ROLE(regs.settings.roles, i) == LINK_ROLE_ZONE && sensors[i].celcius >= limit)
+    {
+      return LINK_TRIGGER_ZONE1 + i;
+    }
+  }
+  return LINK_TRIGGER_NONE;
+}
+
+void checkTemp()
+{ // raises a job at the threshold, ends it below threshold - hysteresis, each state held for its minimum time
+  bool running = active.source != LINK_TRIGGER_NONE && tempJob(active.source);
+  int waiting = findJob(true);
+  int16_t limit = temperature.threshold;
+  unsigned long held = millis() - tempChanged;
+  if (running)
+  {
+    limit -= regs.settings.hysteresis;
+  }
+  byte hot = tempTrigger(limit);
+  if (hot != LINK_TRIGGER_NONE && !running && waiting < 0 && held >= secondToMillis(regs.settings.minOff))
+  {
+    addJob(hot, 0);
+  }
+  else if (hot == LINK_TRIGGER_NONE && waiting >= 0)
+  { // cooled down before its turn came
+    dropJob(waiting);
+  }
+  else if (hot == LINK_TRIGGER_NONE && running && !relayBusy() && held >= secondToMillis(regs.settings.minOn))
+  {
+    finishJob();
+  }
+}
+
+void checkTime()
+{ // every rule due since the last pass fires once, missed minutes are caught up (linkScheduleStep)
+  link_time now;
+  noInterrupts();
+  memcpy(&now, &RTC, sizeof(now));
+  bool clock = timeValid;
+  interrupts();
+  uint16_t due = clock ? linkScheduleStep(&scheduleCursor, schedule, scheduleCount, &now) : 0;
+  if (deviceSet.duration == 0)
+  { // a timer job ends when its duration runs out, one of 0 s would hold the valve open
+    return;
+  }
+  for (byte slot = 0; slot < scheduleCount; slot++)
+  { // a catch-up can bring several rules, each one is a job of its own
+    if (due & (1U << slot))
+    {
+      addJob(LINK_TRIGGER_SLOT1 + slot, deviceSet.duration * 60);
+    }
+  }
+}
+
+void debugging()
+{ // about 300 characters, at 115200 baud loop() waits roughly 25 ms for the TX buffer
+#if AUX_DEBUG
+  if (millis() - counter_debugging < DEBUG_INTERVAL)
+  {
+    return;
+  }
+  counter_debugging = millis();
+  Serial.println(temperature.celcius);
+  Serial.print(F("RTC: "));
   Serial.print(RTC.hour);
-  Serial.print(":");
+  Serial.print(':');
   Serial.println(RTC.minute);
-  Serial.print("Timer1: ");
-  Serial.print(timer1.hour);
-  Serial.print(":");
-  Serial.println(timer1.minute);
-  Serial.println(timer1.setting);
-  Serial.print("Timer2: ");
-  Serial.print(timer2.hour);
-  Serial.print(":");
-  Serial.println(timer2.minute);
-  Serial.println(timer2.setting);
-  Serial.print("Timer3: ");
-  Serial.print(timer3.hour);
-  Serial.print(":");
-  Serial.println(timer3.minute);
-  Serial.println(timer3.setting);
-  Serial.print("Duration: ");
+  Serial.print(F("Schedule: "));
+  for (byte i = 0; i < scheduleCount; i++)
+  {
+    Serial.print(LINK_SLOT_MINUTE(schedule[i]) / 60);
+    Serial.print(':');
+    Serial.print(LINK_SLOT_MINUTE(schedule[i]) % 60);
+    if (schedule[i].every > 0)
+    {
+      Serial.print('/');
+      Serial.print(schedule[i].every);
+    }
+    Serial.print((schedule[i].start & LINK_SLOT_ON) ? F(" ") : F("(off) "));
+  }
+  Serial.println();
+  Serial.print(F("Duration: "));
   Serial.println(minuteToMillis(deviceSet.duration));
-  Serial.print("Threshold: ");
+  Serial.print(F("Resolution: "));
+  Serial.println(resolution);
+  Serial.print(F("Sensors: "));
+  for (byte i = 0; i < sensorCount; i++)
+  {
+    Serial.print(sensors[i].celcius);
+    Serial.print(' ');
+  }
+  Serial.println();
+  Serial.print(F("Threshold: "));
   Serial.println(temperature.threshold);
-  Serial.print("Valve-temp: ");
-  Serial.println(valve1);
-  Serial.print("Valve-timer: ");
-  Serial.println(valve2);
-  Serial.print("Q: ");
-  Serial.println(queue);
-  Serial.println("-----------------------------");
+  Serial.print(F("Hysteresis/filter: "));
+  Serial.print(regs.settings.hysteresis);
+  Serial.print('/');
+  Serial.println(regs.settings.filter);
+  Serial.print(F("Min on/off: "));
+  Serial.print(regs.settings.minOn);
+  Serial.print('/');
+  Serial.println(regs.settings.minOff);
+  Serial.print(F("Job/left: "));
+  Serial.print(active.source);
+  Serial.print('/');
+  Serial.println(active.duration);
+  Serial.print(F("Queue: "));
+  for (byte i = 0; i < jobCount; i++)
+  {
+    Serial.print(jobs[i].source);
+    Serial.print(' ');
+  }
+  Serial.print(F("dropped "));
+  Serial.println(jobsDropped);
+  Serial.print(F("Link state/age: "));
+  Serial.print(regs.health.state);
+  Serial.print('/');
+  Serial.println(regs.health.age);
+  Serial.print(F("Link rx/missed/rejected: "));
+  Serial.print(regs.health.received);
+  Serial.print('/');
+  Serial.print(regs.health.missed);
+  Serial.print('/');
+  Serial.println(regs.health.rejected);
+  Serial.println(F("-----------------------------"));
+#endif
 }
 
 void setup()
 {
-  Wire.begin(8);
-  Wire.onReceive(receiveSettings);
-  Wire.onRequest(sendStatus);
-  sensors.begin();
   pinMode(relay1, OUTPUT);
   pinMode(relay2, OUTPUT);
   pinMode(relay3, OUTPUT);
-  Serial.begin(9600);
-  Serial.println("Start ---------");
-  RTC.hour = RTC.minute = timer1.hour = timer1.minute = timer1.setting = timer2.hour = timer2.minute = timer2.setting = timer3.hour = timer3.minute = timer3.setting = 0;
-  deviceSet.duration = 1;
-  temperature.threshold = 45.6;
+  Serial.begin(SERIAL_BAUD);
+  Serial.println(F("Start ---------"));
+  memset(&RTC, 0, sizeof(RTC));
+  memset(&regs, 0, sizeof(regs));
+  regs.version = FW_VERSION;
+  regs.settings.duration = 1;
+  regs.settings.threshold = 4560;
+  regs.settings.resolution = 12;
+  regs.settings.hysteresis = 50;
+  regs.settings.minOn = 60;
+  regs.settings.minOff = 60;
+  regs.settings.filter = 2;
+  regs.settings.policy = LINK_POLICY_MERGE;
+  regs.settings.deadline = 30;
+  temperature.celcius = LINK_TEMP_INVALID;
+  applySettings();
+  if (loadSettings())
+  {
+    Serial.println(F("Settings restored from EEPROM"));
+  }
+  if (loadSchedule())
+  {
+    Serial.println(F("Schedule restored from EEPROM"));
+  }
+  if (findSensors() == 0)
+  {
+    sensorError = LINK_SENSOR_MISSING;
+  }
+  Wire.begin(8); // only after the register map is ready
+  Wire.onReceive(receiveSettings);
+  Wire.onRequest(sendStatus);
   delay(1000);
 }
 
 void loop()
 {
+  readTemp();
+  updateRelays();
+  tickClock();
+  saveSettings();
+  applySchedule();
+  saveSchedule();
   if ((millis() - counter_loop) > 500)
   {
+    checkLink();
     checkTemp();
     checkTime();
-    debugging();
+    runJobs();
+    updateRegisters();
     counter_loop = millis();
   }
+  debugging();
 }
@@ -0,0 +1,103 @@
+#include "Buttons.h"
+
+Buttons::Buttons(uint8_t repeatMask)
+    : repeatMask(repeatMask), stable(0), head(0), tail(0), lost(0)
+{
+  for (uint8_t i = 0; i < MAX; i++)
+  {
+    count[i] = 0;
+    held[i] = 0;
+    next[i] = 0;
+    interval[i] = 0;
+  }
+}
+
+void IRAM_ATTR Buttons::sample(uint8_t down)
+{
+  for (uint8_t i = 0; i < MAX; i++)
+  {
+    uint8_t bit = 1 << i;
+    uint8_t id = i + 1;
+    bool repeat = repeatMask & bit;
+    if ((down & bit) != (stable & bit))
+    {
+      if (++count[i] < BUTTON_DEBOUNCE)
+      {
+        continue;
+      }
+      count[i] = 0;
+      stable ^= bit;
+      if (stable & bit)
+      { // pressed
+        held[i] = 0;
+        next[i] = BUTTON_REPEAT_DELAY;
+        interval[i] = BUTTON_REPEAT_START;
+        if (repeat)
+        {
+          push(BUTTON_PRESS | id);
+        }
+      }
+      else if (!repeat && held[i] < BUTTON_LONG)
+      { // short release
+        push(BUTTON_PRESS | id);
+      }
+      continue;
+    }
+    count[i] = 0;
+    if (!(stable & bit))
+    {
+      continue;
+    }
+    if (held[i] < 0xFFFF)
+    {
+      held[i]++;
+    }
+    if (repeat && --next[i] == 0)
+    {
+      push(BUTTON_REPEAT | id);
+      next[i] = interval[i];
+      interval[i] -= interval[i] / 8 + 1; // 40 34 29 25 21 18 15 13 11 9 8 samples
+      if (interval[i] < BUTTON_REPEAT_MIN)
+      {
+        interval[i] = BUTTON_REPEAT_MIN;
+      }
+    }
+    else if (!repeat && held[i] == BUTTON_LONG)
+    {
+      push(BUTTON_LONG_PRESS | id);
+    }
+  }
+}
+
+uint8_t Buttons::read()
+{
+  if (tail == head)
+  {
+    return 0;
+  }
+  uint8_t event = events[tail];
+  tail = (tail + 1) & (BUTTON_QUEUE - 1);
+  return event;
+}
+
+void Buttons::clear()
+{
+  tail = head;
+}
+
+uint16_t Buttons::dropped() const
+{
+  return lost;
+}
+
+void IRAM_ATTR Buttons::push(uint8_t event)
+{ // single producer, the slot is written before head moves past it
+  uint8_t after = (head + 1) & (BUTTON_QUEUE - 1);
+  if (after == tail)
+  {
+    lost++;
+    return;
+  }
+  events[head] = event;
+  head = after;
+}
@@ -0,0 +1,83 @@
+#ifndef BUTTONS_H
+#define BUTTONS_H
+
+#include <stdint.h>
+
+#if defined(ARDUINO)
+#include <Arduino.h> // IRAM_ATTR
+#endif
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+/*
+Debounced push buttons feeding an event queue
+
+sample() is called from a timer interrupt every BUTTON_SAMPLE_MS with a
+bit per button that is held down. A level has to stay the same for
+BUTTON_DEBOUNCE samples before it counts, the events go into a ring
+buffer that loop() empties with read() whenever it gets to it, so no
+press is lost while loop() is busy.
+
+Buttons in the repeat mask (the arrows) send BUTTON_PRESS as soon as
+they go down and BUTTON_REPEAT while held, first after
+BUTTON_REPEAT_DELAY and then faster and faster down to
+BUTTON_REPEAT_MIN. The other buttons (SET) send BUTTON_PRESS when they
+are released before BUTTON_LONG and BUTTON_LONG once when held longer.
+
+An event is the kind in the high nibble and the button number, bit
+index + 1, in the low nibble. 0 = no event.
+
+Nothing here depends on Arduino, a host build can feed sample() and
+assert on read().
+*/
+
+#define BUTTON_SAMPLE_MS 5
+#define BUTTON_DEBOUNCE 4      // samples, 20 ms
+#define BUTTON_LONG 200        // samples, 1 s
+#define BUTTON_REPEAT_DELAY 80 // samples, 400 ms to the first repeat
+#define BUTTON_REPEAT_START 40 // samples, 200 ms between the first repeats
+#define BUTTON_REPEAT_MIN 8    // samples, 40 ms between repeats at full speed
+#define BUTTON_QUEUE 8         // events, power of 2
+
+#define BUTTON_PRESS 0x10
+#define BUTTON_LONG_PRESS 0x20
+#define BUTTON_REPEAT 0x40
+#define BUTTON_KIND(event) ((event) & 0xF0)
+#define BUTTON_ID(event) ((event) & 0x0F)
+
+class Buttons
+{
+public:
+  static const uint8_t MAX = 4;
+
+  explicit Buttons(uint8_t repeatMask);
+
+  // Timer interrupt, bit n set = button n is down
+  void IRAM_ATTR sample(uint8_t down);
+
+  // Oldest event, 0 when the queue is empty
+  uint8_t read();
+
+  // Forget queued events, after loop() blocked on purpose
+  void clear();
+
+  // Events lost to a full queue
+  uint16_t dropped() const;
+
+private:
+  uint8_t repeatMask;
+  uint8_t stable;            // debounced levels
+  uint8_t count[MAX];        // samples the raw level differed from stable
+  uint16_t held[MAX];        // samples since the debounced press
+  uint8_t next[MAX];         // samples to the next repeat
+  uint8_t interval[MAX];     // samples between repeats, shrinks while held
+  volatile uint8_t events[BUTTON_QUEUE];
+  volatile uint8_t head;     // written by sample()
+  volatile uint8_t tail;     // written by read()
+  volatile uint16_t lost;
+
+  void IRAM_ATTR push(uint8_t event);
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "LcdFrame.h"
+#include <stdio.h>
+#include <string.h>
+
+LcdFrame::LcdFrame() : known(false), col(0), row(0)
+{
+  clear();
+}
+
+void LcdFrame::clear()
+{
+  memset(cells, ' ', sizeof(cells));
+  col = 0;
+  row = 0;
+}
+
+void LcdFrame::invalidate()
+{
+  known = false;
+}
+
+void LcdFrame::setCursor(uint8_t col, uint8_t row)
+{
+  this->col = col;
+  this->row = (row < ROWS) ? row : ROWS - 1;
+}
+
+size_t LcdFrame::write(uint8_t c)
+{
+  if (col >= COLS)
+  {
+    return 0;
+  }
+  cells[row][col++] = c;
+  return 1;
+}
+
+size_t LcdFrame::write(const char *text)
+{
+  size_t n = 0;
+  while (*text)
+  {
+    n += write((uint8_t)*text++);
+  }
+  return n;
+}
+
+size_t LcdFrame::print(const char *text)
+{
+  return write(text);
+}
+
+size_t LcdFrame::print(char c)
+{
+  return write((uint8_t)c);
+}
+
+size_t LcdFrame::print(unsigned char value)
+{
+  return print((unsigned long)value);
+}
+
+size_t LcdFrame::print(int value)
+{
+  return print((long)value);
+}
+
+size_t LcdFrame::print(unsigned int value)
+{
+  return print((unsigned long)value);
+}
+
+size_t LcdFrame::print(long value)
+{
+  char text[12];
+  snprintf(text, sizeof(text), "%ld", value);
+  return write(text);
+}
+
+size_t LcdFrame::print(unsigned long value)
+{
+  char text[11];
+  snprintf(text, sizeof(text), "%lu", value);
+  return write(text);
+}
+
+uint8_t LcdFrame::at(uint8_t col, uint8_t row) const
+{
+  return (col < COLS && row < ROWS) ? cells[row][col] : ' ';
+}
+
+uint8_t LcdFrame::dirty() const
+{
+  uint8_t n = 0;
+  for (uint8_t r = 0; r < ROWS; r++)
+  {
+    for (uint8_t c = 0; c < COLS; c++)
+    {
+      n += changed(c, r) ? 1 : 0;
+    }
+  }
+  return n;
+}
+
+bool LcdFrame::changed(uint8_t c, uint8_t r) const
+{
+  return !known || cells[r][c] != shown[r][c];
+}
@@ -0,0 +1,104 @@
+#ifndef LCD_FRAME_H
+#define LCD_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+In-RAM shadow of a 16x2 character LCD
+
+Menu screens draw into the frame with the usual setCursor/print/write
+calls, nothing goes to the display until flush(). flush() compares the
+frame with what the display already shows and sends only the cells that
+changed. The HD44780 moves its cursor right after every character, so a
+run of changed cells costs one cursor move, and a single unchanged cell
+between two changed ones is rewritten instead of moved over (one data
+byte against one command byte).
+
+Nothing here depends on Arduino, a host build can draw screens into a
+frame and assert on at() or on what flush() sent to a fake display.
+*/
+
+class LcdFrame
+{
+public:
+  static const uint8_t COLS = 16;
+  static const uint8_t ROWS = 2;
+
+  LcdFrame();
+
+  // Blank the frame and home the cursor, the display is not touched
+  void clear();
+
+  // The display content is unknown (after init or a direct clear), the next flush sends every cell
+  void invalidate();
+
+  void setCursor(uint8_t col, uint8_t row);
+
+  // Store a character at the cursor and move right, characters past the last column are dropped
+  size_t write(uint8_t c);
+  size_t write(const char *text);
+
+  size_t print(const char *text);
+  size_t print(char c);
+  size_t print(unsigned char value); // as a number, like Print::print(byte)
+  size_t print(int value);
+  size_t print(unsigned int value);
+  size_t print(long value);
+  size_t print(unsigned long value);
+
+  // Cell content, 0x00-0x07 are the custom characters
+  uint8_t at(uint8_t col, uint8_t row) const;
+
+  // Cells flush() would send
+  uint8_t dirty() const;
+
+  // Send the changed cells through lcd (setCursor(col, row) and write(uint8_t)), returns the bytes sent
+  template <typename Display>
+  uint8_t flush(Display &lcd);
+
+private:
+  uint8_t cells[ROWS][COLS];
+  uint8_t shown[ROWS][COLS]; // what the display shows, valid once known
+  bool known;
+  uint8_t col, row;
+
+  bool changed(uint8_t c, uint8_t r) const;
+};
+
+template <typename Display>
+uint8_t LcdFrame::flush(Display &lcd)
+{
+  uint8_t sent = 0;
+  for (uint8_t r = 0; r < ROWS; r++)
+  {
+    uint8_t at = COLS; // display cursor column on this row, COLS = not here
+    for (uint8_t c = 0; c < COLS; c++)
+    {
+      if (!changed(c, r))
+      {
+        continue;
+      }
+      if (at + 1 == c)
+      { // one clean cell in between, writing it is as cheap as moving past it
+        lcd.write(cells[r][at]);
+        shown[r][at] = cells[r][at];
+        at = c;
+        sent++;
+      }
+      else if (at != c)
+      {
+        lcd.setCursor(c, r);
+        sent++;
+      }
+      lcd.write(cells[r][c]);
+      shown[r][c] = cells[r][c];
+      at = c + 1;
+      sent++;
+    }
+  }
+  known = true;
+  return sent;
+}
+
+#endif
@@ -0,0 +1,180 @@
+#include "LcdI2C.h"
+
+#define LCD_RS 0x01
+#define LCD_EN 0x04
+#define LCD_BACKLIGHT 0x08
+
+#define LCD_CLEAR 0x01
+#define LCD_HOME 0x02
+#define LCD_ENTRY_LEFT 0x06   // cursor moves right, no display shift
+#define LCD_DISPLAY_ON 0x0C   // display on, cursor and blink off
+#define LCD_FUNCTION_2LINE 0x28 // 4 bit, 2 lines, 5x8 dots
+#define LCD_SET_CGRAM 0x40
+#define LCD_SET_DDRAM 0x80
+
+LcdI2C::LcdI2C(uint8_t address, uint8_t cols, uint8_t rows)
+    : address(address), cols(cols), rows(rows), light(LCD_BACKLIGHT), used(0), held(false)
+{
+}
+
+void LcdI2C::init()
+{ // HD44780 datasheet figure 24, the interface may be in any state after power-on
+  delay(50);
+  buffer[used++] = light;
+  transmit();
+  nibble(0x30);
+  delayMicroseconds(4500);
+  nibble(0x30);
+  delayMicroseconds(4500);
+  nibble(0x30);
+  delayMicroseconds(150);
+  nibble(0x20); // 4 bit mode from here on
+  command(LCD_FUNCTION_2LINE);
+  command(LCD_DISPLAY_ON);
+  command(LCD_ENTRY_LEFT);
+  clear();
+}
+
+void LcdI2C::clear()
+{
+  command(LCD_CLEAR);
+  transmit();
+  delayMicroseconds(1600);
+}
+
+void LcdI2C::home()
+{
+  command(LCD_HOME);
+  transmit();
+  delayMicroseconds(1600);
+}
+
+void LcdI2C::backlight()
+{
+  setBacklight(HIGH);
+}
+
+void LcdI2C::noBacklight()
+{
+  setBacklight(LOW);
+}
+
+void LcdI2C::setBacklight(uint8_t on)
+{ // called every loop pass by the backlight timeout, the bus is only used on a change
+  if ((on ? LCD_BACKLIGHT : 0) == light)
+  {
+    return;
+  }
+  light = on ? LCD_BACKLIGHT : 0;
+  if (used == sizeof(buffer))
+  {
+    transmit();
+  }
+  buffer[used++] = light;
+  if (!held)
+  {
+    transmit();
+  }
+}
+
+void LcdI2C::createChar(uint8_t slot, const uint8_t *map)
+{ // leaves the address counter in CGRAM, setCursor() before the next write
+  bool wasHeld = held;
+  held = true;
+  command(LCD_SET_CGRAM | ((slot & 0x07) << 3));
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    send(map[i], LCD_RS);
+  }
+  held = wasHeld;
+  if (!held)
+  {
+    transmit();
+  }
+}
+
+void LcdI2C::setCursor(uint8_t col, uint8_t row)
+{
+  static const uint8_t offsets[] = {0x00, 0x40, 0x14, 0x54};
+  if (row >= rows)
+  {
+    row = rows - 1;
+  }
+  command(LCD_SET_DDRAM | (col + offsets[row & 0x03]));
+}
+
+size_t LcdI2C::write(uint8_t c)
+{
+  send(c, LCD_RS);
+  return 1;
+}
+
+size_t LcdI2C::print(const char *text)
+{
+  bool wasHeld = held;
+  size_t n = 0;
+  held = true;
+  while (*text)
+  {
+    n += write((uint8_t)*text++);
+  }
+  held = wasHeld;
+  if (!held)
+  {
+    transmit();
+  }
+  return n;
+}
+
+void LcdI2C::hold()
+{
+  held = true;
+}
+
+void LcdI2C::release()
+{
+  held = false;
+  transmit();
+}
+
+void LcdI2C::command(uint8_t value)
+{
+  send(value, 0);
+}
+
+void LcdI2C::send(uint8_t value, uint8_t mode)
+{ // 4 expander bytes, the display latches each nibble on the EN falling edge
+  if (used > sizeof(buffer) - 4)
+  {
+    transmit();
+  }
+  uint8_t high = (value & 0xF0) | mode | light;
+  uint8_t low = (value << 4) | mode | light;
+  buffer[used++] = high | LCD_EN;
+  buffer[used++] = high;
+  buffer[used++] = low | LCD_EN;
+  buffer[used++] = low;
+  if (!held)
+  {
+    transmit();
+  }
+}
+
+void LcdI2C::nibble(uint8_t value)
+{
+  buffer[used++] = (value & 0xF0) | light | LCD_EN;
+  buffer[used++] = (value & 0xF0) | light;
+  transmit();
+}
+
+void LcdI2C::transmit()
+{
+  if (used == 0)
+  {
+    return;
+  }
+  Wire.beginTransmission(address);
+  Wire.write(buffer, used);
+  Wire.endTransmission();
+  used = 0;
+}
@@ -0,0 +1,65 @@
+#ifndef LCD_I2C_H
+#define LCD_I2C_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+/*
+HD44780 in 4 bit mode behind a PCF8574 backpack
+
+PCF8574 pin  P0 RS, P1 RW (held low), P2 EN, P3 backlight, P4-P7 D4-D7
+
+Every character or command goes out as 4 expander bytes, high nibble
+with EN set, high nibble with EN cleared, then the same for the low
+nibble. The display latches on the falling EN edge, so no separate
+strobe transactions or delays are needed between bytes: even at 400 kHz
+two bytes on the bus (45 us) outlast the 37 us a command takes. The
+PCF8574 itself is only specified for 100 kHz, 400 kHz needs a backpack
+with the pin compatible PCA8574.
+
+Bytes are collected in a buffer and sent as one Wire transaction per
+call, or between hold() and release() as few transactions as the Wire
+buffer allows. clear() and home() are the slow commands (1.52 ms) and
+always go out on their own.
+*/
+
+#define LCD_I2C_BATCH (BUFFER_LENGTH / 4 * 4) // expander bytes per transaction, whole characters only
+
+class LcdI2C
+{
+public:
+  LcdI2C(uint8_t address, uint8_t cols, uint8_t rows);
+
+  // Power-on init sequence, 4 bit mode, display on, cursor off, cleared. Wire must be running
+  void init();
+
+  void clear();
+  void home();
+  void backlight();
+  void noBacklight();
+  void setBacklight(uint8_t on);
+
+  // Load a 5x8 custom character into CGRAM slot 0-7, write(slot) shows it
+  void createChar(uint8_t slot, const uint8_t *map);
+
+  void setCursor(uint8_t col, uint8_t row);
+  size_t write(uint8_t c);
+  size_t print(const char *text); // one transaction for a whole line
+
+  // Collect everything until release() instead of sending per call
+  void hold();
+  void release();
+
+private:
+  uint8_t address, cols, rows, light;
+  uint8_t buffer[LCD_I2C_BATCH];
+  uint8_t used;
+  bool held;
+
+  void command(uint8_t value);
+  void send(uint8_t value, uint8_t mode);
+  void nibble(uint8_t value); // init only, one nibble on its own
+  void transmit();
+};
+
+#endif
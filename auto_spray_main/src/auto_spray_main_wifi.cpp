@@ -1,41 +1,59 @@
 #include "Arduino.h"
+#include <stdarg.h>
 #include <Wire.h>
-#include <LiquidCrystal_I2C.h>
+#include <LcdI2C.h>
 #include <EEPROM.h>
 #include <LittleFS.h>
 #include <ESP8266Wifi.h>
 #include <ESPAsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <DNSServer.h>
+#include <SprayLink.h>
+#include <LcdFrame.h>
+#include <Buttons.h>
 
 // Declare variables ---------------------------------------------------
 
 /*
-temperature.threshold = float, address at 0-3
+temperature.threshold = int16 centi C, address at 0-1 (float at 0-3 in layout 1)
 deviceSet.backlight = byte, address 4
 deviceSet.duration = byte, address at 5
-timer1.hour = byte, address at 6
-timer1.minute = byte, address at 7
-timer1.setting = byte, address at 8
-timer2.hour = byte, address at 9
-timer2.minute = byte, address at 10
-timer2.setting = byte, address at 11
-timer3.hour = byte, address at 12
-timer3.minute = byte, address at 13
-timer3.setting = byte, address at 14
 deviceSet.ssid = char array, address at 15 len, address at 16-47 data
 deviceSet.pass = char array, address at 48 len, address at 49-112 data
-
-RTC Address 0x68
+EEPROM layout version = byte, address at 113
+deviceSet.resolution = byte, address at 114
+deviceSet.roles = byte, address at 115
+temperature.hysteresis = int16 centi C, address at 116-117
+deviceSet.minOn = uint16 seconds, address at 118-119
+deviceSet.minOff = uint16 seconds, address at 120-121
+deviceSet.filter = byte, address at 122
+deviceSet.policy = byte, address at 123
+deviceSet.deadline = byte minutes, address at 124
+schedule count = byte, address at 128 (timers at 6-14 in layout 1)
+schedule = link_slot array, address at 129-288
+
+RTC Address 0x68, 1 Hz SQW on GPIO3 (RX, serial runs TX only)
 LCD address 0x27
 Arduino address 0x08
 */
 
-#define EEPROM_SIZE 128
+#define EEPROM_SIZE 512
+#define EEPROM_LAYOUT 2
+#define EEPROM_LAYOUT_ADDRESS 113
+#define SCHEDULE_ADDRESS 128
 #define RTC_ADDRESS 0x68
+#define RTC_SQW_PIN 3
 #define LCD_ADDRESS 0x27
+#define I2C_CLOCK 100000 // the PCF8574 LCD backpack is only specified for 100 kHz, 400 kHz needs a PCA8574 backpack
 #define ATM_ADDRESS 0x08
 
+#define HEARTBEAT_INTERVAL 10000 // full settings + time resend
+#define RETRY_INTERVAL 100       // wait after a NACKed frame
+#define STATUS_INTERVAL 1000     // aux status poll, uses the bus time the RTC reads gave back
+#define SQW_TIMEOUT 1500         // ms without a SQW edge before the RTC is polled instead
+#define HEALTH_INTERVAL 10000    // aux link counters poll
+#define PUSH_INTERVAL 250        // ms between /events pushes at most, changes in between are coalesced
+
 IPAddress APIP(192, 168, 1, 1);
 IPAddress subnet_mask(255, 255, 255, 0);
 
@@ -44,6 +62,7 @@ const byte DNS_PORT = 53;
 
 DNSServer dnsServer;
 AsyncWebServer webServer(WEB_PORT);
+AsyncEventSource events("/events");
 
 class CaptiveRequestHandler : public AsyncWebHandler
 {
@@ -64,35 +83,91 @@ public:
 
 struct temperature_set
 {
-  float threshold, celcius;
+  int16_t threshold, celcius; // centi C, float only at the LCD/web edge
+  int16_t hysteresis;         // centi C below threshold before the spray stops
 } temperature;
 
-struct timer_set
-{
-  byte hour, minute, setting;
-} timer1, timer2, timer3;
-
 struct RTC_now
 {
   byte second, minute, hour, dayOfWeek, dayOfMonth, month, year;
 } RTC;
 
+static_assert(sizeof(RTC_now) == sizeof(link_time), "RTC_now must match the link time frame");
+
 struct device_settings
 {
   byte backlight; // 0: on, 1: 3 sec, 2: 5 sec, 3: 10 sec, 4: off
   byte duration;  // spray duration
+  byte resolution; // DS18B20 resolution on the aux board, 9-12 bit
+  byte roles;      // LINK_ROLE_* of each aux sensor, 2 bits per sensor
+  byte filter;     // aux sensor EMA weight 1/2^filter, 0 = off
+  uint16_t minOn, minOff; // s the temperature spray stays on/off at least
+  byte policy;     // LINK_POLICY_* flags for the aux spray job queue
+  byte deadline;   // minutes a waiting timer job may wait, 0 = no limit
   char ssid[32];
   char pass[63];
 } deviceSet;
 
-union floatToBytes
+struct json_buffer
+{
+  char *text;
+  size_t size, used; // used = size once the text did not fit
+};
+
+#define STATUS_SIZE 2048 // /status body, about 1.5 KB with 16 full schedule rules and a full job queue
+#define STATUS_BUFFERS 3 // /status bodies going out at once, pushStatus() borrows a free one for a moment
+
+struct status_buffer
+{
+  char text[STATUS_SIZE];
+  bool busy; // a /status response is still reading text
+};
+
+status_buffer statusBuffers[STATUS_BUFFERS]; // async handlers run on the small system stack, so not a local
+
+// Web replies are sent straight from flash, a literal passed to send() is copied into a String first
+const char pageSaved[] PROGMEM = "<p>Data telah diterima dan disimpan, untuk kembali ke laman utama klik <a href=\"http://192.168.1.1\">disini</a>.</p>";
+const char pageRestart[] PROGMEM = "<p>Data diterima, alat akan restart.</p><p>Mohon tunggu beberapa saat, kemudian hubungkan kembali ke alat.</p>";
+const char textTooLong[] PROGMEM = "status too long";
+const char textBusy[] PROGMEM = "busy";
+
+struct heap_stats
 {
-  char text[4];
-  float value;
-} fl2b;
+  uint32_t boot;          // free heap once setup() is done
+  uint32_t free, least;   // now and lowest seen
+  uint32_t block;         // largest free block now
+  uint8_t frag, worst;    // fragmentation % now and highest seen
+} heap;
+struct web_asset
+{
+  char name[28]; // file in web/, served at /name
+  char etag[19]; // "16 hex digits", quotes included
+  bool gzip;     // stored as /name.gz
+};
 
-unsigned long counter_send, counter_receive, counter_blink, counter_backlight, counter_debugging = 0;
-byte state, btn_set, blinker, indx, len = 0;
+#define WEB_ASSETS_MAX 8
+
+web_asset webAssets[WEB_ASSETS_MAX]; // from /etag.txt, written by web_gzip.py
+byte webAssetCount = 0;
+uint32_t pushedHash = 0;        // of the status last pushed to /events, 0 = push on the next chance
+unsigned long counter_push = 0, counter_heap = 0;
+
+unsigned long counter_heartbeat, counter_retry, counter_receive, counter_health, counter_blink, counter_backlight, counter_debugging = 0;
+byte state, btn_set, len = 0; // LCD menu: screen, field being edited (0 = none)
+byte txSeq = 0;
+link_settings synced; // settings the aux board acknowledged
+link_slot schedule[LINK_MAX_SLOTS]; // sorted by start minute
+byte scheduleCount = 0;
+bool scheduleSynced = false; // every chunk of the current table was ACKed and the aux board reports it in use
+byte slotEdit, slotMode = 0;  // LCD schedule editor: slot index (scheduleCount = new), 0 off 1 on 2 delete
+uint16_t slotMinute = 0;
+link_registers aux;   // last register values read from the aux board
+RTC_now syncedTime;
+RTC_now clockEdit;                 // LCD RTC editor, the cache keeps running underneath
+volatile unsigned long sqwTicks = 0; // DS3231 1 Hz edges, counted in rtcTick()
+unsigned long sqwSeen = 0, counter_clock = 0;
+bool sqwAlive = false; // edges arrive, otherwise the RTC is polled once a second
+unsigned int linkRejected = 0;
 bool backlight_btn = true;
 bool restart = false;
 
@@ -106,12 +181,16 @@ const int buttonUp = 14;
 const int buttonDown = 12;
 const int buttonSet = 13;
 
-unsigned long lastDebounceTime = 0;
-unsigned long debounceDelay = 250;
+#define BUTTON_TIMER_TICKS (312500UL * BUTTON_SAMPLE_MS / 1000) // timer1 at 80 MHz / 256
+
+Buttons buttons(0x03); // bit 0 UP, 1 DOWN repeat while held, bit 2 SET has a long press
 
 int lcdColumns = 16;
 int lcdRows = 2;
-LiquidCrystal_I2C lcd(LCD_ADDRESS, lcdColumns, lcdRows);
+LcdI2C lcd(LCD_ADDRESS, lcdColumns, lcdRows);
+LcdFrame frame; // screens draw here, showFrame() sends only the changed cells
+unsigned long lcdFlushTime, lcdFlushMax = 0; // us, last and slowest flush (a full screen after a state change)
+byte lcdFlushBytes = 0;
 
 byte charDegree[8] = {
     0b00010,
@@ -123,140 +202,244 @@ byte charDegree[8] = {
     0b00000,
     0b00000};
 
-byte charT1[8] = {
-    0b11100,
-    0b01000,
-    0b01000,
-    0b00010,
-    0b00110,
-    0b00010,
-    0b00010,
-    0b00111};
-
-byte charT2[8] = {
-    0b11100,
-    0b01000,
-    0b01000,
-    0b00110,
-    0b00001,
-    0b00010,
-    0b00100,
-    0b00111};
-
-byte charT3[8] = {
-    0b11100,
-    0b01000,
-    0b01000,
-    0b00110,
-    0b00001,
-    0b00010,
-    0b00001,
-    0b00110};
+byte charTimer[8] = {
+    0b00000,
+    0b01110,
+    0b10101,
+    0b10111,
+    0b10001,
+    0b01110,
+    0b00000,
+    0b00000};
 
 // Declare functions ---------------------------------------------------
 
-void sendSettings();
+bool sendFrame(byte type, const void *payload, byte len);
+void buildSettings(link_settings *settings);
+void syncSettings();
+bool sendSchedule();
+bool readRegisters(byte reg, byte len);
 void receiveStatus();
 void factoryReset();
 void writeChartoEEPROM();
 void fetchEEPROM();
-bool buttonRead(int pin);
+void migrateEEPROM();
+void defaultControl();
+void defaultPolicy();
+void loadSchedule();
+void saveSchedule();
+uint16_t minuteOfDay();
+byte nextSlot(uint16_t *at);
+char *formatMinute(char *buf, uint16_t minute);
+bool parseDate(const char *text, uint16_t *date);
+bool parseClock(const char *text, uint16_t *minute);
+char *formatTemp(char *buf, int16_t centi);
+bool parseTemp(const char *text, int16_t *centi);
 void backlightMode();
 unsigned long minuteToMillis(unsigned long minute);
 byte decToBcd(byte val);
 byte bcdToDec(byte val);
 void setDS3231time(byte second, byte minute, byte hour, byte dayOfWeek, byte dayOfMonth, byte month, byte year);
 void readDS3231time(byte *second, byte *minute, byte *hour, byte *dayOfWeek, byte *dayOfMonth, byte *month, byte *year);
+void setupDS3231();
+void rtcTick();
+void sampleButtons();
+void updateClock();
 void debugging();
+void displayAuxStatus();
 void displayMain();
-void displayTempSet();
-void displayTempSetEdit();
-void displayTimeSet();
-void displayTimeSetT1Hour();
-void displayTimeSetT1Minute();
-void displayTimeSetT2Hour();
-void displayTimeSetT2Minute();
-void displayTimeSetT3Hour();
-void displayTimeSetT3Minute();
-void displayTimerSelect();
-void displayTimerSelectT1Edit();
-void displayTimerSelectT2Edit();
-void displayTimerSelectT3Edit();
-void displayDurationSet();
-void displayDurationSetEdit();
-void displayBacklightSettings();
-void displayBacklightSettingsEdit();
-void displayRTCset();
-void displayRTCsetHour();
-void displayRTCsetMinute();
+void displaySchedule();
+void displaySlotSelect();
+void displaySlotEdit(byte hide);
+void commitSlot();
+void displayScheduleMenu();
+void buttonSchedule(byte key);
+void prepareClock();
+void commitClock();
 void displayFactoryReset();
-void displayFactoryResetConfirm();
+void buttonFactoryReset(byte key);
+bool menuBlink();
+void setupButtons();
+byte readButtons();
 void displayMenu();
+void showFrame();
 void buttonMenu();
-String statusTimer(byte status);
-String concatTime(byte hour, byte minute);
+void jsonAdd(json_buffer *out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void statusAux(json_buffer *out);
+void statusControl(json_buffer *out);
+void statusSchedule(json_buffer *out);
+void statusHeap(json_buffer *out);
+void statusAll(json_buffer *out, bool heap);
+status_buffer *freeStatusBuffer();
+uint32_t hashText(const char *text);
+void loadAssets();
+const char *contentType(const char *name);
+void serveAsset(AsyncWebServerRequest *request, byte index);
+void pushStatus();
+void trackHeap();
 void setupServer();
 
 // I2C Comms -----------------------------------------------------------
 
-void sendSettings()
-{ // send per sec
-  if (millis() - counter_send >= 1000)
-  {
-    Wire.beginTransmission(ATM_ADDRESS);
-    fl2b.value = temperature.threshold;
-    Wire.write(fl2b.text, 4);
-    Wire.write(RTC.hour);
-    Wire.write(RTC.minute);
-    Wire.write(deviceSet.duration);
-    Wire.write(timer1.hour);
-    Wire.write(timer1.minute);
-    Wire.write(timer1.setting);
-    Wire.write(timer2.hour);
-    Wire.write(timer2.minute);
-    Wire.write(timer2.setting);
-    Wire.write(timer3.hour);
-    Wire.write(timer3.minute);
-    Wire.write(timer3.setting);
-    Wire.endTransmission();
-    counter_send = millis();
+bool sendFrame(byte type, const void *payload, byte len)
+{ // true once the aux board ACKed the whole frame
+  byte frame[LINK_MAX_FRAME];
+  byte n = linkPack(frame, type, txSeq++, payload, len);
+  Wire.beginTransmission(ATM_ADDRESS);
+  Wire.write(frame, n);
+  return Wire.endTransmission() == 0;
+}
+
+void buildSettings(link_settings *settings)
+{
+  settings->threshold = temperature.threshold;
+  settings->duration = deviceSet.duration;
+  settings->resolution = deviceSet.resolution;
+  settings->roles = deviceSet.roles;
+  settings->hysteresis = temperature.hysteresis;
+  settings->minOn = deviceSet.minOn;
+  settings->minOff = deviceSet.minOff;
+  settings->filter = deviceSet.filter;
+  settings->policy = deviceSet.policy;
+  settings->deadline = deviceSet.deadline;
+}
+
+void syncSettings()
+{ // send changed fields as soon as they change, full frame + time as heartbeat,
+  // the schedule only goes out after an edit or when the aux board reports a different table
+  link_settings now;
+  buildSettings(&now);
+  if (millis() - counter_heartbeat >= HEARTBEAT_INTERVAL)
+  {
+    if (sendFrame(LINK_MSG_SETTINGS, &now, sizeof(now)) && sendFrame(LINK_MSG_TIME, &RTC, sizeof(RTC)))
+    {
+      synced = now;
+      syncedTime = RTC;
+    }
+    if (readRegisters(LINK_REG(schedule), sizeof(link_table)) &&
+        (aux.schedule.count != scheduleCount || aux.schedule.crc != linkScheduleCrc(schedule, scheduleCount)))
+    {
+      scheduleSynced = false; // aux board restarted or lost chunks, resent below
+    }
+    counter_heartbeat = millis();
+    return;
+  }
+  if (millis() - counter_retry < RETRY_INTERVAL)
+  {
+    return;
+  }
+  if (!scheduleSynced)
+  {
+    scheduleSynced = sendSchedule();
+    if (!scheduleSynced)
+    {
+      counter_retry = millis();
+    }
+  }
+  byte payload[LINK_MAX_PAYLOAD];
+  byte len = linkPackDelta(payload, &now, &synced);
+  if (len > 0)
+  {
+    if (sendFrame(LINK_MSG_DELTA, payload, len))
+    {
+      synced = now;
+    }
+    else
+    {
+      counter_retry = millis();
+    }
+  }
+  // seconds are left out, the time only goes out when the minute or date rolls over
+  if (memcmp(&RTC.minute, &syncedTime.minute, sizeof(RTC) - offsetof(RTC_now, minute)) != 0)
+  {
+    if (sendFrame(LINK_MSG_TIME, &RTC, sizeof(RTC)))
+    {
+      syncedTime = RTC;
+    }
+    else
+    {
+      counter_retry = millis();
+    }
+  }
+}
+
+bool sendSchedule()
+{ // one frame per chunk, the aux board keeps its old table until all of them are in
+  byte payload[LINK_MAX_PAYLOAD];
+  byte first = 0;
+  do
+  {
+    byte len = linkPackSchedule(payload, schedule, scheduleCount, first);
+    if (!sendFrame(LINK_MSG_SCHEDULE, payload, len))
+    {
+      return false;
+    }
+    first += (len - sizeof(link_schedule_header)) / sizeof(link_slot);
+  } while (first < scheduleCount);
+  return true;
+}
+
+bool readRegisters(byte reg, byte len)
+{ // pointer write + burst read, lands in aux at the same offset
+  link_pointer pointer = {reg, len};
+  if (!sendFrame(LINK_MSG_POINTER, &pointer, sizeof(pointer)))
+  {
+    return false;
+  }
+  byte frame[LINK_MAX_FRAME];
+  byte n = 0;
+  Wire.requestFrom(ATM_ADDRESS, LINK_FRAME_SIZE(len + 1));
+  while (Wire.available())
+  {
+    byte data = Wire.read();
+    if (n < sizeof(frame))
+    {
+      frame[n++] = data;
+    }
+  }
+  link_frame parsed;
+  if (linkParse(frame, n, &parsed) != LINK_OK || parsed.type != LINK_MSG_REGISTERS || parsed.len != len + 1 || parsed.payload[0] != reg)
+  {
+    linkRejected++;
+    return false;
   }
+  memcpy((byte *)&aux + reg, parsed.payload + 1, len);
+  return true;
 }
 
 void receiveStatus()
-{ // receive per sec
-  if (millis() - counter_receive >= 1000)
+{
+  if (millis() - counter_receive >= STATUS_INTERVAL)
   {
-    Wire.requestFrom(ATM_ADDRESS, 4);
-    while (Wire.available())
+    if (readRegisters(LINK_REG(status), LINK_REG_SPAN(status, zones)))
     {
-      fl2b.text[indx] = Wire.read();
-      indx++;
+      temperature.celcius = aux.status.celcius;
     }
-    indx = 0;
-    temperature.celcius = fl2b.value;
+    readRegisters(LINK_REG(queue), sizeof(link_queue));
     counter_receive = millis();
   }
+  if (millis() - counter_health >= HEALTH_INTERVAL)
+  {
+    readRegisters(LINK_REG(health), sizeof(link_health));
+    counter_health = millis();
+  }
 }
 
 // Utility function -----------------------------------------------------
 
 void factoryReset()
 {
-  setDS3231time(00, 00, 00, 7, 01, 10, 22);
-  temperature.threshold = 30.5;
+  setDS3231time(00, 00, 00, RTC.dayOfWeek, RTC.dayOfMonth, RTC.month, RTC.year);
+  temperature.threshold = 3050;
   EEPROM.put(0, temperature.threshold);
+  EEPROM.put(EEPROM_LAYOUT_ADDRESS, (byte)EEPROM_LAYOUT);
+  EEPROM.put(114, (byte)12);
+  EEPROM.put(115, (byte)0);
+  defaultControl();
+  defaultPolicy();
   EEPROM.put(4, 0);
   EEPROM.put(5, 1);
-  EEPROM.put(6, 0);
-  EEPROM.put(7, 0);
-  EEPROM.put(8, 0);
-  EEPROM.put(9, 0);
-  EEPROM.put(10, 0);
-  EEPROM.put(11, 0);
-  EEPROM.put(12, 0);
-  EEPROM.put(13, 0);
-  EEPROM.put(14, 0);
+  EEPROM.put(SCHEDULE_ADDRESS, (byte)0);
   strcpy(deviceSet.ssid, "ESP Mtech");
   len = strlen(deviceSet.ssid);
   EEPROM.put(15, len);
@@ -275,20 +458,102 @@ void factoryReset()
   restart = true;
 }
 
+void defaultControl()
+{ // 0.5 C band, 1 minute minimum on/off, EMA 1/4
+  EEPROM.put(116, (int16_t)50);
+  EEPROM.put(118, (uint16_t)60);
+  EEPROM.put(120, (uint16_t)60);
+  EEPROM.put(122, (byte)2);
+}
+
+void defaultPolicy()
+{ // timer jobs merge, nothing preempts, a deferred timer job waits up to 30 minutes
+  EEPROM.put(123, (byte)LINK_POLICY_MERGE);
+  EEPROM.put(124, (byte)30);
+}
+
+void migrateEEPROM()
+{ // layout 1, the first release, never wrote the layout byte: threshold as a float at 0-3,
+  // three fixed timers at 6-14 and nothing at 114-124 (0xFF at 115 would turn every sensor LINK_ROLE_OFF)
+  if (EEPROM.read(EEPROM_LAYOUT_ADDRESS) == EEPROM_LAYOUT)
+  {
+    return;
+  }
+  float legacy;
+  EEPROM.get(0, legacy);
+  temperature.threshold = (legacy > -55 && legacy < 125) ? (int16_t)(legacy * 100 + (legacy < 0 ? -0.5 : 0.5)) : 3050;
+  EEPROM.put(0, temperature.threshold);
+  EEPROM.put(114, (byte)12);
+  EEPROM.put(115, (byte)0);
+  defaultControl();
+  defaultPolicy();
+  scheduleCount = 0;
+  for (byte i = 0; i < 3; i++)
+  { // hour, minute, on/off; unused timers were left at 00:00 off
+    byte hour = EEPROM.read(6 + i * 3), minute = EEPROM.read(7 + i * 3), on = EEPROM.read(8 + i * 3);
+    if (hour < 24 && minute < 60 && (on == 1 || hour != 0 || minute != 0))
+    {
+      schedule[scheduleCount++] = linkSlot(hour * 60 + minute, on == 1);
+    }
+  }
+  linkScheduleSort(schedule, scheduleCount);
+  saveSchedule();
+  EEPROM.put(EEPROM_LAYOUT_ADDRESS, (byte)EEPROM_LAYOUT);
+  EEPROM.commit();
+}
+
+void loadSchedule()
+{ // anything out of range drops the whole table rather than spraying at a random time
+  scheduleCount = EEPROM.read(SCHEDULE_ADDRESS);
+  if (scheduleCount > LINK_MAX_SLOTS)
+  {
+    scheduleCount = 0;
+  }
+  for (byte i = 0; i < scheduleCount; i++)
+  {
+    EEPROM.get(SCHEDULE_ADDRESS + 1 + i * sizeof(link_slot), schedule[i]);
+    if (LINK_SLOT_MINUTE(schedule[i]) >= LINK_MINUTES_PER_DAY || schedule[i].end >= LINK_MINUTES_PER_DAY)
+    {
+      scheduleCount = 0;
+    }
+  }
+  linkScheduleSort(schedule, scheduleCount);
+}
+
+void saveSchedule()
+{ // caller commits
+  EEPROM.put(SCHEDULE_ADDRESS, scheduleCount);
+  for (byte i = 0; i < scheduleCount; i++)
+  {
+    EEPROM.put(SCHEDULE_ADDRESS + 1 + i * sizeof(link_slot), schedule[i]);
+  }
+}
+
 void fetchEEPROM()
 {
+  migrateEEPROM();
   EEPROM.get(0, temperature.threshold);
   EEPROM.get(4, deviceSet.backlight);
   EEPROM.get(5, deviceSet.duration);
-  EEPROM.get(6, timer1.hour);
-  EEPROM.get(7, timer1.minute);
-  EEPROM.get(8, timer1.setting);
-  EEPROM.get(9, timer2.hour);
-  EEPROM.get(10, timer2.minute);
-  EEPROM.get(11, timer2.setting);
-  EEPROM.get(12, timer3.hour);
-  EEPROM.get(13, timer3.minute);
-  EEPROM.get(14, timer3.setting);
+  loadSchedule();
+  EEPROM.get(114, deviceSet.resolution);
+  EEPROM.get(115, deviceSet.roles);
+  EEPROM.get(116, temperature.hysteresis);
+  EEPROM.get(118, deviceSet.minOn);
+  EEPROM.get(120, deviceSet.minOff);
+  EEPROM.get(122, deviceSet.filter);
+  EEPROM.get(123, deviceSet.policy);
+  EEPROM.get(124, deviceSet.deadline);
+  if (deviceSet.resolution < 9 || deviceSet.resolution > 12)
+  {
+    deviceSet.resolution = 12;
+  }
+  deviceSet.duration = constrain(deviceSet.duration, LINK_DURATION_MIN, LINK_DURATION_MAX);
+  temperature.hysteresis = constrain(temperature.hysteresis, 0, LINK_HYSTERESIS_MAX);
+  deviceSet.minOn = min(deviceSet.minOn, (uint16_t)LINK_MIN_TIME_MAX);
+  deviceSet.minOff = min(deviceSet.minOff, (uint16_t)LINK_MIN_TIME_MAX);
+  deviceSet.filter = min(deviceSet.filter, (byte)LINK_FILTER_MAX);
+  deviceSet.policy &= LINK_POLICY_MERGE | LINK_POLICY_PREEMPT | LINK_POLICY_TIMER_FIRST;
   byte len;
   EEPROM.get(15, len);
   for (int i = 0; i < len; i++)
@@ -302,28 +567,6 @@ void fetchEEPROM()
   }
 }
 
-bool buttonRead(int pin)
-{
-  if ((millis() - lastDebounceTime) > debounceDelay)
-  {
-    if (digitalRead(pin) == LOW)
-    {
-      lastDebounceTime = millis();
-      backlight_btn = true;
-      return true;
-    }
-    else
-    {
-      backlight_btn = false;
-      return false;
-    }
-  }
-  else
-  {
-    return false;
-  }
-}
-
 void backlightMode()
 {
   if (deviceSet.backlight == 0)
@@ -358,11 +601,113 @@ void backlightMode()
   }
 }
 
+char *formatTemp(char *buf, int16_t centi)
+{ // "30.50", "-2.25", buf needs 8 bytes
+  if (centi == LINK_TEMP_INVALID)
+  {
+    strcpy(buf, "--.--");
+    return buf;
+  }
+  unsigned int value = centi < 0 ? -centi : centi;
+  sprintf(buf, "%s%u.%02u", centi < 0 ? "-" : "", value / 100, value % 100);
+  return buf;
+}
+
+bool parseTemp(const char *text, int16_t *centi)
+{ // "30.5", "30,5", "-2.25", anything past 2 decimals is dropped
+  bool negative = (*text == '-');
+  if (negative)
+  {
+    text++;
+  }
+  long value = 0;
+  byte digits = 0;
+  while (*text >= '0' && *text <= '9' && value < 1000)
+  {
+    value = value * 10 + (*text++ - '0');
+    digits++;
+  }
+  value *= 100;
+  if (*text == '.' || *text == ',')
+  {
+    text++;
+    if (*text >= '0' && *text <= '9')
+    {
+      value += (*text++ - '0') * 10;
+      digits++;
+    }
+    if (*text >= '0' && *text <= '9')
+    {
+      value += (*text++ - '0');
+    }
+  }
+  if (digits == 0 || value > 12500)
+  {
+    return false;
+  }
+  *centi = negative ? -value : value;
+  return true;
+}
+
 unsigned long minuteToMillis(unsigned long minute)
 {
   return minute * 60 * 1000;
 }
 
+uint16_t minuteOfDay()
+{
+  return RTC.hour * 60 + RTC.minute;
+}
+
+byte nextSlot(uint16_t *at)
+{ // rule with the next run within a week, *at minutes from today 00:00, scheduleCount if none
+  return linkScheduleNext(schedule, scheduleCount, (const link_time *)&RTC, at);
+}
+
+char *formatMinute(char *buf, uint16_t minute)
+{ // "06:30", buf needs 6 bytes
+  minute %= LINK_MINUTES_PER_DAY;
+  sprintf(buf, "%02u:%02u", minute / 60, minute % 60);
+  return buf;
+}
+
+bool parseDate(const char *text, uint16_t *date)
+{ // "MM-DD" of a season, empty = all year (0)
+  unsigned int month, day;
+  if (*text == 0)
+  {
+    *date = 0;
+    return true;
+  }
+  if (sscanf(text, "%2u-%2u", &month, &day) != 2 || month < 1 || month > 12 || day < 1 || day > linkDaysInMonth(month, 0))
+  {
+    return false;
+  }
+  *date = LINK_DATE(month, day);
+  return true;
+}
+
+bool parseClock(const char *text, uint16_t *minute)
+{ // "06:30" or "6:30"
+  byte hour = 0, min = 0, digits = 0;
+  while (*text >= '0' && *text <= '9' && digits < 2)
+  {
+    hour = hour * 10 + (*text++ - '0');
+    digits++;
+  }
+  if (digits == 0 || *text++ != ':' || !(text[0] >= '0' && text[0] <= '9' && text[1] >= '0' && text[1] <= '9'))
+  {
+    return false;
+  }
+  min = (text[0] - '0') * 10 + (text[1] - '0');
+  if (hour > 23 || min > 59)
+  {
+    return false;
+  }
+  *minute = hour * 60 + min;
+  return true;
+}
+
 byte decToBcd(byte val)
 { // Convert normal decimal numbers to binary coded decimal
   return ((val / 10 * 16) + (val % 10));
@@ -385,6 +730,7 @@ void setDS3231time(byte second, byte minute, byte hour, byte dayOfWeek, byte day
   Wire.write(decToBcd(month));      // set month
   Wire.write(decToBcd(year));       // set year (0 to 99)
   Wire.endTransmission();
+  RTC = {second, minute, hour, dayOfWeek, dayOfMonth, month, year}; // the next SQW edge is a second away
 }
 
 void readDS3231time(byte *second, // Read from RTC
@@ -408,36 +754,113 @@ void readDS3231time(byte *second, // Read from RTC
   *year = bcdToDec(Wire.read());
 }
 
+void setupDS3231()
+{ // control register 0Eh = 0: oscillator on, INTCN off, 1 Hz square wave on INT/SQW
+  Wire.beginTransmission(RTC_ADDRESS);
+  Wire.write(0x0E);
+  Wire.write(0x00);
+  Wire.endTransmission();
+  pinMode(RTC_SQW_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(RTC_SQW_PIN), rtcTick, FALLING);
+}
+
+void IRAM_ATTR rtcTick()
+{ // falling edge, the seconds register has just advanced
+  sqwTicks++;
+}
+
+void updateClock()
+{ // the cached RTC is read once a second, on the SQW edge or by polling while no edges arrive
+  unsigned long ticks = sqwTicks;
+  bool edge = (ticks != sqwSeen);
+  if (!edge && millis() - counter_clock < (sqwAlive ? SQW_TIMEOUT : 1000))
+  {
+    return;
+  }
+  sqwAlive = edge;
+  sqwSeen = ticks;
+  counter_clock = millis();
+  readDS3231time(&RTC.second, &RTC.minute, &RTC.hour, &RTC.dayOfWeek, &RTC.dayOfMonth, &RTC.month, &RTC.year);
+}
+
 void debugging()
 {
   if ((millis() - counter_debugging) > 5000)
   {
-    Serial.println(temperature.celcius);
+    char temp[8];
+    Serial.println(formatTemp(temp, temperature.celcius));
     Serial.print("RTC: ");
     Serial.print(RTC.hour);
     Serial.print(":");
-    Serial.println(RTC.minute);
-    Serial.print("Timer1: ");
-    Serial.print(timer1.hour);
-    Serial.print(":");
-    Serial.println(timer1.minute);
-    Serial.println(timer1.setting);
-    Serial.print("Timer2: ");
-    Serial.print(timer2.hour);
-    Serial.print(":");
-    Serial.println(timer2.minute);
-    Serial.println(timer2.setting);
-    Serial.print("Timer3: ");
-    Serial.print(timer3.hour);
-    Serial.print(":");
-    Serial.println(timer3.minute);
-    Serial.println(timer3.setting);
+    Serial.print(RTC.minute);
+    Serial.println(sqwAlive ? " (SQW)" : " (polled)");
+    uint16_t at;
+    Serial.print("Schedule slots/next: ");
+    Serial.print(scheduleCount);
+    Serial.print("/");
+    Serial.println(nextSlot(&at) < scheduleCount ? formatMinute(temp, at) : "-");
     Serial.print("Duration: ");
     Serial.println(minuteToMillis(deviceSet.duration));
     Serial.print("Threshold: ");
-    Serial.println(temperature.threshold);
+    Serial.println(formatTemp(temp, temperature.threshold));
+    Serial.print("Hysteresis/filter: ");
+    Serial.print(formatTemp(temp, temperature.hysteresis));
+    Serial.print("/");
+    Serial.println(deviceSet.filter);
+    Serial.print("Min on/off: ");
+    Serial.print(deviceSet.minOn);
+    Serial.print("/");
+    Serial.println(deviceSet.minOff);
     Serial.print("Backlight: ");
     Serial.println(deviceSet.backlight);
+    Serial.print("Link rejected: ");
+    Serial.println(linkRejected);
+    Serial.print("Aux fw/faults/sensor: ");
+    Serial.print(aux.version);
+    Serial.print("/");
+    Serial.print(aux.status.faults);
+    Serial.print("/");
+    Serial.println(aux.status.sensorError);
+    Serial.print("Aux valves/trigger/remaining: ");
+    Serial.print(aux.status.valves, HEX);
+    Serial.print("/");
+    Serial.print(aux.status.trigger);
+    Serial.print("/");
+    Serial.println(aux.status.remaining);
+    Serial.print("Aux queue/dropped: ");
+    Serial.print(aux.queue.count);
+    Serial.print("/");
+    Serial.println(aux.queue.dropped);
+    Serial.print("LCD flush us/bytes/max us: ");
+    Serial.print(lcdFlushTime);
+    Serial.print("/");
+    Serial.print(lcdFlushBytes);
+    Serial.print("/");
+    Serial.println(lcdFlushMax);
+    Serial.print("Aux uptime: ");
+    Serial.println(aux.status.uptime);
+    Serial.print("Aux link state/rx/missed/rejected/outages: ");
+    Serial.print(aux.health.state);
+    Serial.print("/");
+    Serial.print(aux.health.received);
+    Serial.print("/");
+    Serial.print(aux.health.missed);
+    Serial.print("/");
+    Serial.print(aux.health.rejected);
+    Serial.print("/");
+    Serial.println(aux.health.outages);
+    Serial.print("Heap boot/free/least/block/frag/worst: ");
+    Serial.print(heap.boot);
+    Serial.print("/");
+    Serial.print(heap.free);
+    Serial.print("/");
+    Serial.print(heap.least);
+    Serial.print("/");
+    Serial.print(heap.block);
+    Serial.print("/");
+    Serial.print(heap.frag);
+    Serial.print("/");
+    Serial.println(heap.worst);
     Serial.println("-----------------------------");
     byte error, address;
     int nDevices = 0;
@@ -470,1724 +893,1030 @@ void debugging()
   }
 }
 
-// Menu item function ----------------------------------------------------------------
+// Menu table ------------------------------------------------------------------------
 
-void displayMain()
+/*
+Every LCD screen is one menu_screen row, indexed by state. Row 0 shows
+the title, row 1 the fields of the screen side by side. SET steps
+through the fields (btn_set = field + 1), after the last one every field
+with an EEPROM address is written back and the done hook runs. Holding
+SET stores right away, on the overview it goes back to the main screen. Screens
+with a draw/key hook (main, schedule, factory reset) handle themselves.
+A new setting is a menu_field row and a screen row pointing at it.
+*/
+
+enum menu_kind : byte
 {
-  readDS3231time(&RTC.second, &RTC.minute, &RTC.hour, &RTC.dayOfWeek, &RTC.dayOfMonth, &RTC.month, &RTC.year);
-  lcd.setCursor(0, 0);
-  lcd.print("Temp:");
-  lcd.setCursor(6, 0);
-  lcd.print(temperature.celcius);
-  lcd.setCursor(11, 0);
-  lcd.write((uint8_t)0);
-  lcd.setCursor(12, 0);
-  lcd.print("C");
-  lcd.setCursor(0, 1);
-  lcd.print("Time:");
-  lcd.setCursor(6, 1);
-  if (RTC.hour < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(7, 1);
-    lcd.print(RTC.hour);
-  }
-  else
-  {
-    lcd.print(RTC.hour);
-  }
-  lcd.setCursor(8, 1);
-  lcd.print(":");
-  lcd.setCursor(9, 1);
-  if (RTC.minute < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(10, 1);
-    lcd.print(RTC.minute);
-  }
-  else
-  {
-    lcd.print(RTC.minute);
-  }
-}
+  MENU_NUMBER = 0, // value and unit
+  MENU_TEMP,       // centi C as "30.50", degree sign and C
+  MENU_CLOCK,      // two digits, zero padded, and unit
+  MENU_LABELS,     // the value-th of the '|' separated labels in unit
+  MENU_FLAG        // mask bit of a byte, labels in unit for off|on
+};
 
-void displayTempSet()
+enum menu_key : byte
 {
-  lcd.setCursor(0, 0);
-  lcd.print("Temp Threshold");
-  lcd.setCursor(0, 1);
-  lcd.print(temperature.threshold);
-  lcd.setCursor(4, 1);
-  lcd.write((uint8_t)0);
-  lcd.setCursor(5, 1);
-  lcd.print("C");
-}
+  KEY_NONE = 0,
+  KEY_UP,
+  KEY_DOWN,
+  KEY_SET,
+  KEY_DONE // SET held, leave the editor
+};
 
-void displayTempSetEdit()
+struct menu_field
 {
-  lcd.setCursor(0, 0);
-  lcd.print("Temp Threshold");
-  lcd.setCursor(4, 1);
-  lcd.write((uint8_t)0);
-  lcd.setCursor(5, 1);
-  lcd.print("C");
-}
+  byte kind;         // menu_kind
+  byte col;          // column on row 1
+  const char *label; // PROGMEM, printed before the value, may be NULL
+  const char *unit;  // PROGMEM, unit or labels, may be NULL
+  void *value;       // RAM variable, byte for size 1, int16_t/uint16_t for size 2
+  byte size;
+  byte mask;         // MENU_FLAG bit
+  int16_t min, max, step;
+  bool wrap;         // past max goes to min and the other way, otherwise it stops
+  int16_t eeprom;    // address the value is stored at, -1 = none
+};
 
-void displayTimeSet()
+struct menu_screen
 {
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
+  const char *title;     // PROGMEM
+  byte first, count;     // menuFields[first..first + count)
+  void (*prepare)();     // before every draw while not editing, may be NULL
+  void (*done)();        // after the last field is stored, may be NULL
+  void (*draw)();        // custom screen instead of title and fields, may be NULL
+  void (*key)(byte key); // custom editing while btn_set > 0, may be NULL
+};
 
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
-  lcd.setCursor(10, 0);
-  if (timer1.hour < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(11, 0);
-    lcd.print(timer1.hour);
-  }
-  else
+const char textThreshold[] PROGMEM = "Temp Threshold";
+const char textDuration[] PROGMEM = "Spray Duration";
+const char textHysteresis[] PROGMEM = "Hysteresis";
+const char textMinTime[] PROGMEM = "Min On/Off Time";
+const char textFilter[] PROGMEM = "Sensor Filter";
+const char textPolicy[] PROGMEM = "Job Policy";
+const char textDeadline[] PROGMEM = "Max Wait, 0=none";
+const char textBacklight[] PROGMEM = "Backlight";
+const char textClock[] PROGMEM = "RTC Set";
+const char textOn[] PROGMEM = "On:";
+const char textOff[] PROGMEM = "Off:";
+const char textMerge[] PROGMEM = "Mrg:";
+const char textPreempt[] PROGMEM = "Pre:";
+const char textTimerFirst[] PROGMEM = "Tm:";
+const char textMin[] PROGMEM = " min";
+const char textSecond[] PROGMEM = "s";
+const char textColon[] PROGMEM = ":";
+const char textYesNo[] PROGMEM = "N|Y";
+const char textFilters[] PROGMEM = "Off|EMA 1/2|EMA 1/4|EMA 1/8|EMA 1/16";
+const char textBacklights[] PROGMEM = "Always on|3 sec|5 sec|10 sec|Always off";
+
+const menu_field menuFields[] PROGMEM = {
+    {MENU_TEMP, 0, NULL, NULL, &temperature.threshold, 2, 0, -5500, 12500, 10, false, 0},
+    {MENU_NUMBER, 0, NULL, textMin, &deviceSet.duration, 1, 0, LINK_DURATION_MIN, LINK_DURATION_MAX, 1, true, 5},
+    {MENU_TEMP, 0, NULL, NULL, &temperature.hysteresis, 2, 0, 0, LINK_HYSTERESIS_MAX, 10, false, 116},
+    {MENU_NUMBER, 0, textOn, textSecond, &deviceSet.minOn, 2, 0, 0, LINK_MIN_TIME_MAX, 10, false, 118},
+    {MENU_NUMBER, 8, textOff, textSecond, &deviceSet.minOff, 2, 0, 0, LINK_MIN_TIME_MAX, 10, false, 120},
+    {MENU_LABELS, 0, NULL, textFilters, &deviceSet.filter, 1, 0, 0, LINK_FILTER_MAX, 1, false, 122},
+    {MENU_FLAG, 0, textMerge, textYesNo, &deviceSet.policy, 1, LINK_POLICY_MERGE, 0, 1, 1, true, 123},
+    {MENU_FLAG, 6, textPreempt, textYesNo, &deviceSet.policy, 1, LINK_POLICY_PREEMPT, 0, 1, 1, true, 123},
+    {MENU_FLAG, 12, textTimerFirst, textYesNo, &deviceSet.policy, 1, LINK_POLICY_TIMER_FIRST, 0, 1, 1, true, 123},
+    {MENU_NUMBER, 0, NULL, textMin, &deviceSet.deadline, 1, 0, 0, 240, 5, false, 124},
+    {MENU_LABELS, 0, NULL, textBacklights, &deviceSet.backlight, 1, 0, 0, 4, 1, false, 4},
+    {MENU_CLOCK, 0, NULL, textColon, &clockEdit.hour, 1, 0, 0, 23, 1, true, -1},
+    {MENU_CLOCK, 3, NULL, NULL, &clockEdit.minute, 1, 0, 0, 59, 1, true, -1},
+};
+
+const menu_screen menuScreens[] PROGMEM = {
+    {NULL, 0, 0, NULL, NULL, displayMain, NULL},
+    {textThreshold, 0, 1, NULL, NULL, NULL, NULL},
+    {NULL, 0, 0, NULL, NULL, displayScheduleMenu, buttonSchedule},
+    {textDuration, 1, 1, NULL, NULL, NULL, NULL},
+    {textHysteresis, 2, 1, NULL, NULL, NULL, NULL},
+    {textMinTime, 3, 2, NULL, NULL, NULL, NULL},
+    {textFilter, 5, 1, NULL, NULL, NULL, NULL},
+    {textPolicy, 6, 3, NULL, NULL, NULL, NULL},
+    {textDeadline, 9, 1, NULL, NULL, NULL, NULL},
+    {textBacklight, 10, 1, NULL, NULL, NULL, NULL},
+    {textClock, 11, 2, prepareClock, commitClock, NULL, NULL},
+    {NULL, 0, 0, NULL, NULL, displayFactoryReset, buttonFactoryReset},
+};
+
+#define MENU_SCREENS (sizeof(menuScreens) / sizeof(menuScreens[0]))
+
+// Menu item function ----------------------------------------------------------------
+
+void displayAuxStatus()
+{ // col 13-15 row 0: sensor error, spray source; col 12-15 row 1: timer spray minutes left
+  frame.setCursor(13, 0);
+  if (aux.status.faults & LINK_FAULT_SENSOR)
   {
-    lcd.print(timer1.hour);
+    frame.print(" E");
+    frame.print(aux.status.sensorError);
   }
-  lcd.setCursor(12, 0);
-  lcd.print(":");
-  lcd.setCursor(13, 0);
-  if (timer1.minute < 10)
+  else if ((aux.status.valves & LINK_VALVE_TEMP) && aux.status.trigger == LINK_TRIGGER_TEMP)
   {
-    lcd.print("0");
-    lcd.setCursor(14, 0);
-    lcd.print(timer1.minute);
+    frame.print("  *");
   }
-  else
+  else if ((aux.status.valves & LINK_VALVE_TEMP) && aux.status.trigger >= LINK_TRIGGER_ZONE1 && aux.status.trigger < LINK_TRIGGER_SLOT1)
   {
-    lcd.print(timer1.minute);
+    frame.print(" Z");
+    frame.print(aux.status.trigger - LINK_TRIGGER_ZONE1 + 1);
   }
-
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-  lcd.setCursor(2, 1);
-  if (timer2.hour < 10)
+  else if ((aux.status.valves & LINK_VALVE_TIMER) && aux.status.trigger >= LINK_TRIGGER_SLOT1)
   {
-    lcd.print("0");
-    lcd.setCursor(3, 1);
-    lcd.print(timer2.hour);
+    byte slot = aux.status.trigger - LINK_TRIGGER_SLOT1 + 1;
+    frame.write((uint8_t)1); // charTimer
+    if (slot < 10)
+    {
+      frame.print(" ");
+    }
+    frame.print(slot);
   }
   else
   {
-    lcd.print(timer2.hour);
+    frame.print("   ");
   }
-  lcd.setCursor(4, 1);
-  lcd.print(":");
-  lcd.setCursor(5, 1);
-  if (timer2.minute < 10)
+  frame.setCursor(12, 1);
+  if (aux.status.valves & LINK_VALVE_TIMER)
   {
-    lcd.print("0");
-    lcd.setCursor(6, 1);
-    lcd.print(timer2.minute);
+    byte left = (aux.status.remaining + 59) / 60;
+    if (left < 10)
+    {
+      frame.print(" ");
+    }
+    frame.print(left);
+    frame.print("m");
   }
   else
   {
-    lcd.print(timer2.minute);
+    frame.print("   ");
   }
+}
 
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
-  lcd.setCursor(10, 1);
-  if (timer3.hour < 10)
+void displayMain()
+{
+  frame.setCursor(0, 0);
+  frame.print("Temp:");
+  frame.setCursor(6, 0);
+  char temp[8];
+  frame.print(formatTemp(temp, temperature.celcius));
+  frame.setCursor(11, 0);
+  frame.write((uint8_t)0);
+  frame.setCursor(12, 0);
+  frame.print("C");
+  displayAuxStatus();
+  frame.setCursor(0, 1);
+  frame.print("Time:");
+  frame.setCursor(6, 1);
+  if (RTC.hour < 10)
   {
-    lcd.print("0");
-    lcd.setCursor(11, 1);
-    lcd.print(timer3.hour);
+    frame.print("0");
+    frame.setCursor(7, 1);
+    frame.print(RTC.hour);
   }
   else
   {
-    lcd.print(timer3.hour);
+    frame.print(RTC.hour);
   }
-  lcd.setCursor(12, 1);
-  lcd.print(":");
-  lcd.setCursor(13, 1);
-  if (timer3.minute < 10)
+  frame.setCursor(8, 1);
+  frame.print(":");
+  frame.setCursor(9, 1);
+  if (RTC.minute < 10)
   {
-    lcd.print("0");
-    lcd.setCursor(14, 1);
-    lcd.print(timer3.minute);
+    frame.print("0");
+    frame.setCursor(10, 1);
+    frame.print(RTC.minute);
   }
   else
   {
-    lcd.print(timer3.minute);
+    frame.print(RTC.minute);
   }
 }
 
-void displayTimeSetT1Hour()
+void displaySchedule()
 {
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
-
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
-  lcd.setCursor(12, 0);
-  lcd.print(":");
-  lcd.setCursor(13, 0);
-  if (timer1.minute < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(14, 0);
-    lcd.print(timer1.minute);
+  char line[17];
+  frame.setCursor(0, 0);
+  snprintf(line, sizeof(line), "Schedule   %2u/%u", scheduleCount, LINK_MAX_SLOTS);
+  frame.print(line);
+  frame.setCursor(0, 1);
+  const char *days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+  char time[6];
+  uint16_t at;
+  if (nextSlot(&at) < scheduleCount)
+  { // weekday only when the next run is not today
+    snprintf(line, sizeof(line), "Next %s %-10s", formatMinute(time, at), at >= LINK_MINUTES_PER_DAY ? days[(RTC.dayOfWeek - 1 + at / LINK_MINUTES_PER_DAY) % 7] : "");
   }
   else
   {
-    lcd.print(timer1.minute);
+    snprintf(line, sizeof(line), "Next --:--      ");
   }
+  frame.print(line);
+}
 
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-  lcd.setCursor(2, 1);
-  if (timer2.hour < 10)
+void displaySlotSelect()
+{
+  char line[17], time[6], end[6];
+  frame.setCursor(0, 0);
+  if (slotEdit < scheduleCount)
   {
-    lcd.print("0");
-    lcd.setCursor(3, 1);
-    lcd.print(timer2.hour);
+    snprintf(line, sizeof(line), "Slot %u/%u", slotEdit + 1, scheduleCount);
   }
   else
   {
-    lcd.print(timer2.hour);
-  }
-  lcd.setCursor(4, 1);
-  lcd.print(":");
-  lcd.setCursor(5, 1);
-  if (timer2.minute < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(6, 1);
-    lcd.print(timer2.minute);
+    snprintf(line, sizeof(line), "Slot +");
   }
-  else
+  frame.print(line);
+  for (byte i = strlen(line); i < 16; i++)
   {
-    lcd.print(timer2.minute);
+    frame.print(" ");
   }
-
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
-  lcd.setCursor(10, 1);
-  if (timer3.hour < 10)
+  frame.setCursor(0, 1);
+  if (slotEdit < scheduleCount)
   {
-    lcd.print("0");
-    lcd.setCursor(11, 1);
-    lcd.print(timer3.hour);
+    link_slot *slot = &schedule[slotEdit];
+    const char *on = (slot->start & LINK_SLOT_ON) ? "On" : "Off";
+    if (slot->every > 0)
+    { // interval rule, "06:00-18:00 On"
+      snprintf(line, sizeof(line), "%s-%s %-4s", formatMinute(time, LINK_SLOT_MINUTE(*slot)), formatMinute(end, slot->end), on);
+    }
+    else
+    {
+      snprintf(line, sizeof(line), "%s %-10s", formatMinute(time, LINK_SLOT_MINUTE(*slot)), on);
+    }
   }
   else
   {
-    lcd.print(timer3.hour);
+    snprintf(line, sizeof(line), "%-16s", "New slot");
   }
-  lcd.setCursor(12, 1);
-  lcd.print(":");
-  lcd.setCursor(13, 1);
-  if (timer3.minute < 10)
+  frame.print(line);
+}
+
+void displaySlotEdit(byte hide)
+{ // hide: 1 hour, 2 minute, 3 mode blanked for the blink
+  const char *mode[] = {"Off", "On", "Delete"};
+  frame.setCursor(0, 0);
+  if (slotEdit < scheduleCount)
   {
-    lcd.print("0");
-    lcd.setCursor(14, 1);
-    lcd.print(timer3.minute);
+    frame.print("Slot ");
+    frame.print(slotEdit + 1);
   }
   else
   {
-    lcd.print(timer3.minute);
+    frame.print("New slot");
   }
-}
-
-void displayTimeSetT1Minute()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
-
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
-  lcd.setCursor(10, 0);
-  if (timer1.hour < 10)
+  frame.setCursor(0, 1);
+  if (hide != 1)
   {
-    lcd.print("0");
-    lcd.setCursor(11, 0);
-    lcd.print(timer1.hour);
+    if (slotMinute / 60 < 10)
+    {
+      frame.print("0");
+    }
+    frame.print(slotMinute / 60);
   }
-  else
+  frame.setCursor(2, 1);
+  frame.print(":");
+  if (hide != 2)
   {
-    lcd.print(timer1.hour);
+    if (slotMinute % 60 < 10)
+    {
+      frame.print("0");
+    }
+    frame.print(slotMinute % 60);
   }
-  lcd.setCursor(12, 0);
-  lcd.print(":");
-
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-  lcd.setCursor(2, 1);
-  if (timer2.hour < 10)
+  frame.setCursor(6, 1);
+  if (hide != 3)
   {
-    lcd.print("0");
-    lcd.setCursor(3, 1);
-    lcd.print(timer2.hour);
+    frame.print(mode[slotMode]);
   }
-  else
+}
+
+void commitSlot()
+{ // apply the LCD edit, keep the table sorted and resync it. Days, season and interval
+  // of a rule are only edited from the web page, moving an interval rule moves its end too
+  if (slotMode == 2)
   {
-    lcd.print(timer2.hour);
+    scheduleCount--;
+    memmove(&schedule[slotEdit], &schedule[slotEdit + 1], (scheduleCount - slotEdit) * sizeof(link_slot));
   }
-  lcd.setCursor(4, 1);
-  lcd.print(":");
-  lcd.setCursor(5, 1);
-  if (timer2.minute < 10)
+  else if (slotEdit == scheduleCount)
   {
-    lcd.print("0");
-    lcd.setCursor(6, 1);
-    lcd.print(timer2.minute);
+    schedule[scheduleCount++] = linkSlot(slotMinute, slotMode == 1);
   }
   else
   {
-    lcd.print(timer2.minute);
+    link_slot *slot = &schedule[slotEdit];
+    int16_t end = slot->end + slotMinute - LINK_SLOT_MINUTE(*slot);
+    slot->end = constrain(end, (int16_t)slotMinute, (int16_t)(LINK_MINUTES_PER_DAY - 1));
+    slot->start = slotMinute | (slotMode == 1 ? LINK_SLOT_ON : 0);
   }
+  linkScheduleSort(schedule, scheduleCount);
+  saveSchedule();
+  EEPROM.commit();
+  scheduleSynced = false;
+  slotEdit = 0;
+}
 
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
-  lcd.setCursor(10, 1);
-  if (timer3.hour < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(11, 1);
-    lcd.print(timer3.hour);
-  }
-  else
+void displayScheduleMenu()
+{ // btn_set 0 overview, 1 slot select, 2 hour, 3 minute, 4 off/on/delete
+  if (btn_set == 0)
   {
-    lcd.print(timer3.hour);
+    displaySchedule();
   }
-  lcd.setCursor(12, 1);
-  lcd.print(":");
-  lcd.setCursor(13, 1);
-  if (timer3.minute < 10)
+  else if (btn_set == 1)
   {
-    lcd.print("0");
-    lcd.setCursor(14, 1);
-    lcd.print(timer3.minute);
+    if (slotEdit > scheduleCount || slotEdit == LINK_MAX_SLOTS)
+    {
+      slotEdit = 0;
+    }
+    displaySlotSelect();
   }
   else
   {
-    lcd.print(timer3.minute);
+    displaySlotEdit(menuBlink() ? btn_set - 1 : 0);
   }
 }
 
-void displayTimeSetT2Hour()
+void buttonSchedule(byte key)
 {
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
-
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
-  lcd.setCursor(10, 0);
-  if (timer1.hour < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(11, 0);
-    lcd.print(timer1.hour);
+  if (key == KEY_DONE)
+  { // keep what was set so far
+    if (btn_set >= 2)
+    {
+      commitSlot();
+    }
+    btn_set = 0;
   }
-  else
+  else if (btn_set == 1)
+  {
+    byte last = (scheduleCount < LINK_MAX_SLOTS) ? scheduleCount : scheduleCount - 1; // scheduleCount = new slot
+    if (key == KEY_UP)
+    {
+      slotEdit = (slotEdit > 0) ? slotEdit - 1 : last;
+    }
+    else if (key == KEY_DOWN)
+    {
+      slotEdit = (slotEdit < last) ? slotEdit + 1 : 0;
+    }
+    else if (slotEdit < scheduleCount)
+    {
+      slotMinute = LINK_SLOT_MINUTE(schedule[slotEdit]);
+      slotMode = (schedule[slotEdit].start & LINK_SLOT_ON) ? 1 : 0;
+      btn_set = 2;
+    }
+    else
+    {
+      slotMinute = minuteOfDay();
+      slotMode = 1;
+      btn_set = 2;
+    }
+  }
+  else if (btn_set == 2)
   {
-    lcd.print(timer1.hour);
+    if (key == KEY_UP)
+    {
+      slotMinute = (slotMinute + 60) % (24 * 60);
+    }
+    else if (key == KEY_DOWN)
+    {
+      slotMinute = (slotMinute + 23 * 60) % (24 * 60);
+    }
+    else
+    {
+      btn_set = 3;
+    }
   }
-  lcd.setCursor(12, 0);
-  lcd.print(":");
-  lcd.setCursor(13, 0);
-  if (timer1.minute < 10)
+  else if (btn_set == 3)
   {
-    lcd.print("0");
-    lcd.setCursor(14, 0);
-    lcd.print(timer1.minute);
+    if (key == KEY_UP)
+    {
+      slotMinute = slotMinute - slotMinute % 60 + (slotMinute + 1) % 60;
+    }
+    else if (key == KEY_DOWN)
+    {
+      slotMinute = slotMinute - slotMinute % 60 + (slotMinute + 59) % 60;
+    }
+    else
+    {
+      btn_set = 4;
+    }
   }
   else
   {
-    lcd.print(timer1.minute);
+    byte modes = (slotEdit < scheduleCount) ? 3 : 2; // a new slot can't be deleted
+    if (key == KEY_UP)
+    {
+      slotMode = (slotMode + modes - 1) % modes;
+    }
+    else if (key == KEY_DOWN)
+    {
+      slotMode = (slotMode + 1) % modes;
+    }
+    else
+    {
+      commitSlot();
+      btn_set = 0;
+    }
   }
+}
+
+void prepareClock()
+{ // the RTC screen shows the live clock until SET starts editing a copy
+  clockEdit = RTC;
+}
+
+void commitClock()
+{
+  setDS3231time(00, clockEdit.minute, clockEdit.hour, RTC.dayOfWeek, RTC.dayOfMonth, RTC.month, RTC.year);
+}
 
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-  lcd.setCursor(4, 1);
-  lcd.print(":");
-  lcd.setCursor(5, 1);
-  if (timer2.minute < 10)
+void displayFactoryReset()
+{
+  frame.setCursor(0, 0);
+  if (btn_set == 0)
   {
-    lcd.print("0");
-    lcd.setCursor(6, 1);
-    lcd.print(timer2.minute);
+    frame.print("Factory Reset");
+    return;
   }
-  else
+  frame.print("Confirm?");
+  frame.setCursor(0, 1);
+  frame.print("Arrow to Cancel");
+}
+
+void buttonFactoryReset(byte key)
+{
+  if (key != KEY_SET)
+  {
+    btn_set = 0;
+    return;
+  }
+  factoryReset();
+  frame.clear();
+  frame.setCursor(4, 0);
+  frame.print("Success!");
+  showFrame();
+  delay(2000);
+  buttons.clear(); // presses while the message was up
+  btn_set = 0;
+  state = 0;
+}
+
+// Menu engine ------------------------------------------------------------------------
+
+char *copyText(char *buf, const char *text)
+{ // PROGMEM string into a 17 byte buffer
+  strncpy_P(buf, text, 16);
+  buf[16] = 0;
+  return buf;
+}
+
+char *copyLabel(char *buf, const char *labels, byte index)
+{ // index-th of the '|' separated PROGMEM labels, buf needs 17 bytes
+  byte n = 0;
+  char c;
+  while ((c = pgm_read_byte(labels++)) != 0)
   {
-    lcd.print(timer2.minute);
+    if (c == '|')
+    {
+      index--;
+    }
+    else if (index == 0 && n < 16)
+    {
+      buf[n++] = c;
+    }
   }
+  buf[n] = 0;
+  return buf;
+}
 
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
-  lcd.setCursor(10, 1);
-  if (timer3.hour < 10)
+int16_t menuGet(const menu_field *field)
+{
+  if (field->kind == MENU_FLAG)
   {
-    lcd.print("0");
-    lcd.setCursor(11, 1);
-    lcd.print(timer3.hour);
+    return (*(byte *)field->value & field->mask) ? 1 : 0;
   }
-  else
+  return (field->size == 1) ? *(byte *)field->value : *(int16_t *)field->value;
+}
+
+void menuSet(const menu_field *field, int16_t value)
+{
+  if (field->kind == MENU_FLAG)
   {
-    lcd.print(timer3.hour);
+    byte *flags = (byte *)field->value;
+    *flags = value ? (*flags | field->mask) : (*flags & ~field->mask);
   }
-  lcd.setCursor(12, 1);
-  lcd.print(":");
-  lcd.setCursor(13, 1);
-  if (timer3.minute < 10)
+  else if (field->size == 1)
   {
-    lcd.print("0");
-    lcd.setCursor(14, 1);
-    lcd.print(timer3.minute);
+    *(byte *)field->value = value;
   }
   else
   {
-    lcd.print(timer3.minute);
+    *(int16_t *)field->value = value;
   }
 }
 
-void displayTimeSetT2Minute()
+void menuStep(const menu_field *field, int8_t direction)
 {
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
-
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
-  lcd.setCursor(10, 0);
-  if (timer1.hour < 10)
+  int16_t value = menuGet(field) + direction * field->step;
+  if (value > field->max)
   {
-    lcd.print("0");
-    lcd.setCursor(11, 0);
-    lcd.print(timer1.hour);
+    value = field->wrap ? field->min : field->max;
   }
-  else
+  if (value < field->min)
   {
-    lcd.print(timer1.hour);
+    value = field->wrap ? field->max : field->min;
   }
-  lcd.setCursor(12, 0);
-  lcd.print(":");
-  lcd.setCursor(13, 0);
-  if (timer1.minute < 10)
+  menuSet(field, value);
+}
+
+void menuStore(const menu_screen *screen)
+{ // write every field of the screen that has an EEPROM address
+  bool dirty = false;
+  for (byte i = 0; i < screen->count; i++)
   {
-    lcd.print("0");
-    lcd.setCursor(14, 0);
-    lcd.print(timer1.minute);
+    menu_field field;
+    memcpy_P(&field, &menuFields[screen->first + i], sizeof(field));
+    if (field.eeprom < 0)
+    {
+      continue;
+    }
+    if (field.size == 1)
+    {
+      EEPROM.put(field.eeprom, *(byte *)field.value);
+    }
+    else
+    {
+      EEPROM.put(field.eeprom, *(int16_t *)field.value);
+    }
+    dirty = true;
   }
-  else
+  if (dirty)
   {
-    lcd.print(timer1.minute);
+    EEPROM.commit();
   }
+}
 
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-  lcd.setCursor(2, 1);
-  if (timer2.hour < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(3, 1);
-    lcd.print(timer2.hour);
-  }
-  else
+bool menuBlink()
+{ // the edited value is hidden every other 750 ms, shown right after a key press
+  return btn_set > 0 && (millis() - counter_blink) % 1500 >= 750;
+}
+
+void displayField(const menu_field *field, bool hide)
+{
+  char text[17];
+  frame.setCursor(field->col, 1);
+  if (field->label != NULL)
   {
-    lcd.print(timer2.hour);
+    frame.print(copyText(text, field->label));
   }
-  lcd.setCursor(4, 1);
-  lcd.print(":");
-
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
-  lcd.setCursor(10, 1);
-  if (timer3.hour < 10)
+  int16_t value = menuGet(field);
+  switch (field->kind)
   {
-    lcd.print("0");
-    lcd.setCursor(11, 1);
-    lcd.print(timer3.hour);
+  case MENU_TEMP:
+    formatTemp(text, value);
+    break;
+  case MENU_CLOCK:
+    sprintf(text, "%02d", value);
+    break;
+  case MENU_LABELS:
+  case MENU_FLAG:
+    copyLabel(text, field->unit, value);
+    break;
+  default:
+    sprintf(text, "%d", value);
+    break;
   }
-  else
+  if (hide)
   {
-    lcd.print(timer3.hour);
+    memset(text, ' ', strlen(text));
   }
-  lcd.setCursor(12, 1);
-  lcd.print(":");
-  lcd.setCursor(13, 1);
-  if (timer3.minute < 10)
+  frame.print(text);
+  if (field->kind == MENU_TEMP)
   {
-    lcd.print("0");
-    lcd.setCursor(14, 1);
-    lcd.print(timer3.minute);
+    frame.write((uint8_t)0);
+    frame.print("C");
   }
-  else
+  else if ((field->kind == MENU_NUMBER || field->kind == MENU_CLOCK) && field->unit != NULL)
   {
-    lcd.print(timer3.minute);
+    frame.print(copyText(text, field->unit));
   }
 }
 
-void displayTimeSetT3Hour()
+void IRAM_ATTR sampleButtons()
+{ // timer1 interrupt, keeps sampling while loop() is blocked on I2C or the web server
+  byte down = 0;
+  down |= (digitalRead(buttonUp) == LOW) ? 0x01 : 0;
+  down |= (digitalRead(buttonDown) == LOW) ? 0x02 : 0;
+  down |= (digitalRead(buttonSet) == LOW) ? 0x04 : 0;
+  buttons.sample(down);
+}
+
+void setupButtons()
 {
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
+  pinMode(buttonUp, INPUT_PULLUP);
+  pinMode(buttonDown, INPUT_PULLUP);
+  pinMode(buttonSet, INPUT_PULLUP);
+  timer1_attachInterrupt(sampleButtons);
+  timer1_enable(TIM_DIV256, TIM_EDGE, TIM_LOOP);
+  timer1_write(BUTTON_TIMER_TICKS);
+}
 
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
-  lcd.setCursor(10, 0);
-  if (timer1.hour < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(11, 0);
-    lcd.print(timer1.hour);
-  }
-  else
-  {
-    lcd.print(timer1.hour);
-  }
-  lcd.setCursor(12, 0);
-  lcd.print(":");
-  lcd.setCursor(13, 0);
-  if (timer1.minute < 10)
+byte readButtons()
+{ // oldest queued event as a menu key, repeats step like presses
+  byte event = buttons.read();
+  byte key = KEY_NONE;
+  if (BUTTON_KIND(event) == BUTTON_LONG_PRESS)
   {
-    lcd.print("0");
-    lcd.setCursor(14, 0);
-    lcd.print(timer1.minute);
+    key = KEY_DONE;
   }
-  else
+  else if (event != 0)
   {
-    lcd.print(timer1.minute);
+    key = BUTTON_ID(event); // button n = KEY_UP + n
   }
+  backlight_btn = (key != KEY_NONE);
+  return key;
+}
 
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-  lcd.setCursor(2, 1);
-  if (timer2.hour < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(3, 1);
-    lcd.print(timer2.hour);
-  }
-  else
+// Menu display function -------------------------------------
+
+void displayMenu()
+{ // the whole screen is drawn every pass, showFrame() only sends what changed
+  menu_screen screen;
+  memcpy_P(&screen, &menuScreens[state], sizeof(screen));
+  if (btn_set == 0 && screen.prepare != NULL)
   {
-    lcd.print(timer2.hour);
+    screen.prepare();
   }
-  lcd.setCursor(4, 1);
-  lcd.print(":");
-  lcd.setCursor(5, 1);
-  if (timer2.minute < 10)
+  frame.clear();
+  if (screen.draw != NULL)
   {
-    lcd.print("0");
-    lcd.setCursor(6, 1);
-    lcd.print(timer2.minute);
+    screen.draw();
   }
   else
   {
-    lcd.print(timer2.minute);
+    char text[17];
+    frame.setCursor(0, 0);
+    frame.print(copyText(text, screen.title));
+    for (byte i = 0; i < screen.count; i++)
+    {
+      menu_field field;
+      memcpy_P(&field, &menuFields[screen.first + i], sizeof(field));
+      displayField(&field, btn_set == i + 1 && menuBlink());
+    }
   }
+  showFrame();
+}
 
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
-  lcd.setCursor(12, 1);
-  lcd.print(":");
-  lcd.setCursor(13, 1);
-  if (timer3.minute < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(14, 1);
-    lcd.print(timer3.minute);
-  }
-  else
+void showFrame()
+{ // all changed cells in as few I2C transactions as the Wire buffer allows, timed for debugging()
+  if (frame.dirty() == 0)
   {
-    lcd.print(timer3.minute);
+    return;
   }
+  unsigned long started = micros();
+  lcd.hold();
+  lcdFlushBytes = frame.flush(lcd);
+  lcd.release();
+  lcdFlushTime = micros() - started;
+  lcdFlushMax = max(lcdFlushMax, lcdFlushTime);
 }
 
-void displayTimeSetT3Minute()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
-
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
-  lcd.setCursor(10, 0);
-  if (timer1.hour < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(11, 0);
-    lcd.print(timer1.hour);
-  }
-  else
+void buttonMenu()
+{ // one table lookup for the screen, one for the field being edited
+  byte key = readButtons();
+  if (key == KEY_NONE)
   {
-    lcd.print(timer1.hour);
+    return;
   }
-  lcd.setCursor(12, 0);
-  lcd.print(":");
-  lcd.setCursor(13, 0);
-  if (timer1.minute < 10)
+  counter_blink = millis();
+  menu_screen screen;
+  memcpy_P(&screen, &menuScreens[state], sizeof(screen));
+  if (btn_set == 0)
   {
-    lcd.print("0");
-    lcd.setCursor(14, 0);
-    lcd.print(timer1.minute);
+    if (key == KEY_UP && state > 0)
+    {
+      state--;
+    }
+    else if (key == KEY_DOWN && state < MENU_SCREENS - 1)
+    {
+      state++;
+    }
+    else if (key == KEY_SET && (screen.count > 0 || screen.key != NULL))
+    {
+      btn_set = 1;
+    }
+    else if (key == KEY_DONE)
+    {
+      state = 0;
+    }
+    return;
   }
-  else
+  if (screen.key != NULL)
   {
-    lcd.print(timer1.minute);
+    screen.key(key);
+    return;
   }
-
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-  lcd.setCursor(2, 1);
-  if (timer2.hour < 10)
+  menu_field field;
+  memcpy_P(&field, &menuFields[screen.first + btn_set - 1], sizeof(field));
+  if (key == KEY_UP)
   {
-    lcd.print("0");
-    lcd.setCursor(3, 1);
-    lcd.print(timer2.hour);
+    menuStep(&field, 1);
   }
-  else
+  else if (key == KEY_DOWN)
   {
-    lcd.print(timer2.hour);
+    menuStep(&field, -1);
   }
-  lcd.setCursor(4, 1);
-  lcd.print(":");
-  lcd.setCursor(5, 1);
-  if (timer2.minute < 10)
+  else if (key == KEY_SET && btn_set < screen.count)
   {
-    lcd.print("0");
-    lcd.setCursor(6, 1);
-    lcd.print(timer2.minute);
+    btn_set++;
   }
   else
   {
-    lcd.print(timer2.minute);
+    menuStore(&screen);
+    if (screen.done != NULL)
+    {
+      screen.done();
+    }
+    btn_set = 0;
   }
+}
 
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
-  lcd.setCursor(10, 1);
-  if (timer3.hour < 10)
-  {
-    lcd.print("0");
-    lcd.setCursor(11, 1);
-    lcd.print(timer3.hour);
-  }
-  else
+// Web function ----------------------------------------------
+
+void jsonAdd(json_buffer *out, const char *format, ...)
+{ // printf into the buffer, stops at the end instead of overflowing
+  if (out->used + 1 >= out->size)
   {
-    lcd.print(timer3.hour);
+    out->used = out->size;
+    return;
   }
-  lcd.setCursor(12, 1);
-  lcd.print(":");
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(out->text + out->used, out->size - out->used, format, args);
+  va_end(args);
+  out->used = (n < 0 || out->used + n >= out->size) ? out->size : out->used + n;
 }
 
-void displayTimerSelect()
+void statusAux(json_buffer *out)
 {
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
-  lcd.setCursor(10, 0);
-  if (timer1.setting == 0)
-  {
-    lcd.print("Off");
-  }
-  if (timer1.setting == 1)
-  {
-    lcd.print("On");
-  }
+  char temp[8];
+  jsonAdd(out, "{\"valves\":%u,\"remaining\":%u,\"trigger\":%u,\"sensor\":%u,\"uptime\":%lu",
+          aux.status.valves, aux.status.remaining, aux.status.trigger, aux.status.sensorError, (unsigned long)aux.status.uptime / 60 * 60); // whole minutes, the page shows no more and it would push every second
+  jsonAdd(out, ",\"missed\":%u,\"rejected\":%u,\"outages\":%u,\"roles\":%u,\"zones\":[",
+          aux.health.missed, aux.health.rejected, aux.health.outages, deviceSet.roles);
+  for (byte i = 0; i < aux.zones.count && i < LINK_MAX_SENSORS; i++)
+  {
+    jsonAdd(out, "%s\"%s\"", i > 0 ? "," : "", formatTemp(temp, aux.zones.celcius[i]));
+  }
+  jsonAdd(out, "],\"dropped\":%u,\"queue\":[", aux.queue.dropped);
+  for (byte i = 0; i < aux.queue.count && i < LINK_MAX_JOBS; i++)
+  { // [source, priority, seconds to run, minutes left to start]
+    link_job *job = &aux.queue.jobs[i];
+    jsonAdd(out, "%s[%u,%u,%u,%u]", i > 0 ? "," : "", job->source, job->priority, job->duration, job->wait);
+  }
+  jsonAdd(out, "]}");
+}
 
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-  lcd.setCursor(2, 1);
-  if (timer2.setting == 0)
-  {
-    lcd.print("Off");
-  }
-  if (timer2.setting == 1)
-  {
-    lcd.print("On");
-  }
+void statusControl(json_buffer *out)
+{
+  char temp[8];
+  jsonAdd(out, "{\"hysteresis\":\"%s\",\"minOn\":%u,\"minOff\":%u,\"filter\":%u,\"policy\":%u,\"deadline\":%u}",
+          formatTemp(temp, temperature.hysteresis), deviceSet.minOn, deviceSet.minOff, deviceSet.filter, deviceSet.policy, deviceSet.deadline);
+}
 
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
-  lcd.setCursor(10, 1);
-  if (timer3.setting == 0)
-  {
-    lcd.print("Off");
-  }
-  if (timer3.setting == 1)
+void statusSchedule(json_buffer *out)
+{ // slots: [start, on, end, every, days, from, to], season dates as "MM-DD" or ""
+  char time[6], end[6], from[6], to[6];
+  uint16_t at = 0;
+  byte next = nextSlot(&at);
+  jsonAdd(out, "{\"max\":%u,\"next\":\"%s\",\"nextDay\":%u,\"slots\":[",
+          LINK_MAX_SLOTS, next < scheduleCount ? formatMinute(time, at) : "", at / LINK_MINUTES_PER_DAY);
+  for (byte i = 0; i < scheduleCount; i++)
   {
-    lcd.print("On");
+    link_slot *slot = &schedule[i];
+    from[0] = to[0] = 0;
+    if (slot->from != 0)
+    {
+      sprintf(from, "%02u-%02u", LINK_DATE_MONTH(slot->from), LINK_DATE_DAY(slot->from));
+      sprintf(to, "%02u-%02u", LINK_DATE_MONTH(slot->to), LINK_DATE_DAY(slot->to));
+    }
+    jsonAdd(out, "%s[\"%s\",%u,\"%s\",%u,%u,\"%s\",\"%s\"]", i > 0 ? "," : "",
+            formatMinute(time, LINK_SLOT_MINUTE(*slot)), (slot->start & LINK_SLOT_ON) ? 1 : 0,
+            formatMinute(end, slot->every > 0 ? slot->end : LINK_SLOT_MINUTE(*slot)), slot->every, slot->days, from, to);
   }
+  jsonAdd(out, "]}");
 }
 
-void displayTimerSelectT1Edit()
+void statusHeap(json_buffer *out)
 {
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
+  jsonAdd(out, "{\"boot\":%lu,\"free\":%lu,\"least\":%lu,\"block\":%lu,\"frag\":%u,\"worst\":%u}",
+          (unsigned long)heap.boot, (unsigned long)heap.free, (unsigned long)heap.least, (unsigned long)heap.block, heap.frag, heap.worst);
+}
 
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-  lcd.setCursor(2, 1);
-  if (timer2.setting == 0)
-  {
-    lcd.print("Off");
-  }
-  if (timer2.setting == 1)
-  {
-    lcd.print("On");
-  }
+void statusAll(json_buffer *out, bool heap)
+{ // everything the page shows, one request per refresh
+  char temp[8], thresh[8];
+  jsonAdd(out, "{\"temp\":\"%s\",\"thresh\":\"%s\",\"time\":\"%02u:%02u %02u-%02u-20%02u\",\"duration\":%u,\"resolution\":%u,\"control\":",
+          formatTemp(temp, temperature.celcius), formatTemp(thresh, temperature.threshold),
+          RTC.hour, RTC.minute, RTC.dayOfMonth, RTC.month, RTC.year, deviceSet.duration, deviceSet.resolution);
+  statusControl(out);
+  jsonAdd(out, ",\"schedule\":");
+  statusSchedule(out);
+  jsonAdd(out, ",\"aux\":");
+  statusAux(out);
+  if (heap)
+  {
+    jsonAdd(out, ",\"heap\":");
+    statusHeap(out);
+  }
+  jsonAdd(out, "}");
+}
 
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
-  lcd.setCursor(10, 1);
-  if (timer3.setting == 0)
+status_buffer *freeStatusBuffer()
+{ // NULL while every buffer is still going out
+  for (byte i = 0; i < STATUS_BUFFERS; i++)
   {
-    lcd.print("Off");
-  }
-  if (timer3.setting == 1)
-  {
-    lcd.print("On");
+    if (!statusBuffers[i].busy)
+    {
+      return &statusBuffers[i];
+    }
   }
+  return NULL;
 }
 
-void displayTimerSelectT2Edit()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
-  lcd.setCursor(10, 0);
-  if (timer1.setting == 0)
-  {
-    lcd.print("Off");
-  }
-  if (timer1.setting == 1)
+uint32_t hashText(const char *text)
+{ // FNV-1a, tells a changed status apart without keeping a copy of the last one
+  uint32_t hash = 2166136261UL;
+  while (*text)
   {
-    lcd.print("On");
+    hash = (hash ^ (uint8_t)*text++) * 16777619UL;
   }
+  return hash ? hash : 1;
+}
 
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
-  lcd.setCursor(10, 1);
-  if (timer3.setting == 0)
+void pushStatus()
+{ // the /status body to every /events client, only when it changed and at most every PUSH_INTERVAL
+  status_buffer *buffer = freeStatusBuffer();
+  if (millis() - counter_push < PUSH_INTERVAL || events.count() == 0 || buffer == NULL)
   {
-    lcd.print("Off");
+    return;
   }
-  if (timer3.setting == 1)
+  counter_push = millis();
+  json_buffer out = {buffer->text, sizeof(buffer->text), 0};
+  statusAll(&out, false); // the heap moves on every trackHeap(), hashed it would push every HEALTH_INTERVAL
+  if (out.used >= out.size)
   {
-    lcd.print("On");
+    return;
   }
-}
-
-void displayTimerSelectT3Edit()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("Timer");
-  lcd.setCursor(8, 0);
-  lcd.write((uint8_t)1);
-  lcd.setCursor(10, 0);
-  if (timer1.setting == 0)
+  uint32_t hash = hashText(buffer->text);
+  if (hash == pushedHash)
   {
-    lcd.print("Off");
+    return;
   }
-  if (timer1.setting == 1)
+  out.used--; // reopen the object, the heap rides along with a push that happens anyway
+  jsonAdd(&out, ",\"heap\":");
+  statusHeap(&out);
+  jsonAdd(&out, "}");
+  if (out.used >= out.size)
   {
-    lcd.print("On");
+    return;
   }
+  pushedHash = hash;
+  events.send(buffer->text, "status", millis()); // copied into the client queues, the buffer is free again
+}
 
-  lcd.setCursor(0, 1);
-  lcd.write((uint8_t)2);
-  lcd.setCursor(2, 1);
-  if (timer2.setting == 0)
+void loadAssets()
+{ // "<name> <etag> <gzip|->" per line, a filesystem without the file is served as it is
+  File file = LittleFS.open("/etag.txt", "r");
+  if (!file)
   {
-    lcd.print("Off");
+    return;
   }
-  if (timer2.setting == 1)
+  char line[64], encoding[6];
+  while (file.available() && webAssetCount < WEB_ASSETS_MAX)
   {
-    lcd.print("On");
+    size_t n = file.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[n] = 0;
+    web_asset *asset = &webAssets[webAssetCount];
+    if (sscanf(line, "%27s %18s %5s", asset->name, asset->etag, encoding) == 3)
+    {
+      asset->gzip = (strcmp(encoding, "gzip") == 0);
+      webAssetCount++;
+    }
   }
-
-  lcd.setCursor(8, 1);
-  lcd.write((uint8_t)3);
+  file.close();
 }
 
-void displayDurationSet()
+const char *contentType(const char *name)
 {
-  lcd.setCursor(0, 0);
-  lcd.print("Spray Duration");
-  lcd.setCursor(0, 1);
-  lcd.print(deviceSet.duration);
-  lcd.setCursor(3, 1);
-  lcd.print("min");
-}
-
-void displayDurationSetEdit()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("Spray Duration");
-  lcd.setCursor(3, 1);
-  lcd.print("min");
-}
-
-void displayBacklightSettings()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("Backlight");
-  lcd.setCursor(0, 1);
-  switch (deviceSet.backlight)
+  const char *dot = strrchr(name, '.');
+  if (dot == NULL)
   {
-  case 0:
-    lcd.print("Always on");
-    break;
-  case 1:
-    lcd.print("3 sec");
-    break;
-  case 2:
-    lcd.print("5 sec");
-    break;
-  case 3:
-    lcd.print("10 sec");
-    break;
-  case 4:
-    lcd.print("Always off");
-    break;
+    return "application/octet-stream";
   }
-}
-
-void displayBacklightSettingsEdit()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("Backlight");
-}
-
-void displayRTCset()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("RTC Set");
-  lcd.setCursor(0, 1);
-  if (RTC.hour < 10)
+  if (strcmp(dot, ".html") == 0)
   {
-    lcd.print("0");
-    lcd.setCursor(1, 1);
-    lcd.print(RTC.hour);
+    return "text/html";
   }
-  else
+  if (strcmp(dot, ".css") == 0)
   {
-    lcd.print(RTC.hour);
+    return "text/css";
   }
-  lcd.setCursor(2, 1);
-  lcd.print(":");
-  lcd.setCursor(3, 1);
-  if (RTC.minute < 10)
+  if (strcmp(dot, ".js") == 0)
   {
-    lcd.print("0");
-    lcd.setCursor(4, 1);
-    lcd.print(RTC.minute);
+    return "application/javascript";
   }
-  else
+  if (strcmp(dot, ".png") == 0)
   {
-    lcd.print(RTC.minute);
+    return "image/png";
   }
+  return "application/octet-stream";
 }
 
-void displayRTCsetHour()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("RTC Set");
-  lcd.setCursor(2, 1);
-  lcd.print(":");
-  lcd.setCursor(3, 1);
-  if (RTC.minute < 10)
+void serveAsset(AsyncWebServerRequest *request, byte index)
+{ // 304 when the browser already has this content, the body otherwise
+  web_asset *asset = &webAssets[index];
+  bool page = (strcmp(asset->name, "index.html") == 0); // revalidated on every load, the rest kept a day
+  AsyncWebServerResponse *response;
+  if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == asset->etag)
   {
-    lcd.print("0");
-    lcd.setCursor(4, 1);
-    lcd.print(RTC.minute);
+    response = request->beginResponse(304);
   }
   else
   {
-    lcd.print(RTC.minute);
+    char path[32];
+    snprintf(path, sizeof(path), asset->gzip ? "/%s.gz" : "/%s", asset->name);
+    response = request->beginResponse(LittleFS, path, contentType(asset->name));
+    if (asset->gzip)
+    {
+      response->addHeader("Content-Encoding", "gzip");
+    }
   }
+  response->addHeader("ETag", asset->etag);
+  response->addHeader("Cache-Control", page ? "no-cache" : "max-age=86400");
+  request->send(response);
 }
 
-void displayRTCsetMinute()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("RTC Set");
-  lcd.setCursor(0, 1);
-  if (RTC.hour < 10)
+void trackHeap()
+{ // free heap and fragmentation now and at their worst, to compare the start and the end of a soak test
+  if (millis() - counter_heap < HEALTH_INTERVAL && heap.boot != 0)
   {
-    lcd.print("0");
-    lcd.setCursor(1, 1);
-    lcd.print(RTC.hour);
+    return;
   }
-  else
+  counter_heap = millis();
+  heap.free = ESP.getFreeHeap();
+  heap.block = ESP.getMaxFreeBlockSize();
+  heap.frag = ESP.getHeapFragmentation();
+  if (heap.boot == 0)
   {
-    lcd.print(RTC.hour);
+    heap.boot = heap.least = heap.free;
   }
-  lcd.setCursor(2, 1);
-  lcd.print(":");
-}
-
-void displayFactoryReset()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("Factory Reset");
+  heap.least = min(heap.least, heap.free);
+  heap.worst = max(heap.worst, heap.frag);
 }
 
-void displayFactoryResetConfirm()
-{
-  lcd.setCursor(0, 0);
-  lcd.print("Confirm?");
-  lcd.setCursor(0, 1);
-  lcd.print("Arrow to Cancel");
-}
-
-// Menu display function -------------------------------------
-
-void displayMenu()
+void setupServer()
 {
-  if (state == 0 && btn_set == 0)
-  { // state 0, main menu
-    displayMain();
-  }
-
-  if (state == 1 && btn_set == 0)
-  { // state 1, temp set menu
-    displayTempSet();
-  }
-
-  if (state == 1 && btn_set == 1)
+  loadAssets();
+  for (byte i = 0; i < webAssetCount; i++)
   {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayTempSetEdit();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
+    char uri[32];
+    snprintf(uri, sizeof(uri), "/%s", webAssets[i].name);
+    webServer.on(uri, HTTP_GET, [i](AsyncWebServerRequest *request)
+                 { serveAsset(request, i); });
+    if (strcmp(webAssets[i].name, "index.html") == 0)
     {
-      lcd.clear();
-      displayTempSet();
-      counter_blink = millis();
-      blinker = 0;
+      webServer.on("/", HTTP_GET, [i](AsyncWebServerRequest *request)
+                   { serveAsset(request, i); });
     }
   }
 
-  if (state == 2 && btn_set == 0)
-  { // state 2, timer set menu
-    displayTimeSet();
-  }
-
-  if (state == 2 && btn_set == 1)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayTimeSetT1Hour();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayTimeSet();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
+  webServer.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
+               { request->send(LittleFS, "/index.html", "text/html", false); }); // image without etag.txt
 
-  if (state == 2 && btn_set == 2)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayTimeSetT1Minute();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayTimeSet();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
+  webServer.serveStatic("/", LittleFS, "/").setCacheControl("max-age=31536000"); // 365 days
 
-  if (state == 2 && btn_set == 3)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayTimeSetT2Hour();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayTimeSet();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
+  events.onConnect([](AsyncEventSourceClient *client)
+                   { pushedHash = 0; }); // a new page gets the full status with the next push
+  webServer.addHandler(&events);
 
-  if (state == 2 && btn_set == 4)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayTimeSetT2Minute();
-      counter_blink = millis();
-      blinker = 1;
+  webServer.on("/status", HTTP_GET, [](AsyncWebServerRequest *request)
+               {
+    status_buffer *buffer = freeStatusBuffer();
+    if (buffer == NULL)
+    { // STATUS_BUFFERS bodies are still going out
+      request->send_P(503, "text/plain", textBusy);
+      return;
     }
-    if (millis() - counter_blink > 750 && blinker == 1)
+    json_buffer out = {buffer->text, sizeof(buffer->text), 0};
+    statusAll(&out, true);
+    if (out.used >= out.size)
     {
-      lcd.clear();
-      displayTimeSet();
-      counter_blink = millis();
-      blinker = 0;
+      request->send_P(500, "text/plain", textTooLong);
+      return;
     }
-  }
-
-  if (state == 2 && btn_set == 5)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayTimeSetT3Hour();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayTimeSet();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
-
-  if (state == 2 && btn_set == 6)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayTimeSetT3Minute();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayTimeSet();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
-
-  if (state == 3 && btn_set == 0)
-  { // state 3, choose timer on
-    displayTimerSelect();
-  }
-
-  if (state == 3 && btn_set == 1)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayTimerSelectT1Edit();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayTimerSelect();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
-
-  if (state == 3 && btn_set == 2)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayTimerSelectT2Edit();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayTimerSelect();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
-
-  if (state == 3 && btn_set == 3)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayTimerSelectT3Edit();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayTimerSelect();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
-
-  if (state == 4 && btn_set == 0)
-  { // state 4, set spray duration
-    displayDurationSet();
-  }
-
-  if (state == 4 && btn_set == 1)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayDurationSetEdit();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayDurationSet();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
-
-  if (state == 5 && btn_set == 0)
-  { // state 5, set backlight mode
-    displayBacklightSettings();
-  }
-
-  if (state == 5 && btn_set == 1)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayBacklightSettingsEdit();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayBacklightSettings();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
-
-  if (state == 6 && btn_set == 0)
-  { // state 6, set RTC time
-    displayRTCset();
-  }
-
-  if (state == 6 && btn_set == 1)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayRTCsetHour();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayRTCset();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
-
-  if (state == 6 && btn_set == 2)
-  {
-    if (millis() - counter_blink > 750 && blinker == 0)
-    {
-      lcd.clear();
-      displayRTCsetMinute();
-      counter_blink = millis();
-      blinker = 1;
-    }
-    if (millis() - counter_blink > 750 && blinker == 1)
-    {
-      lcd.clear();
-      displayRTCset();
-      counter_blink = millis();
-      blinker = 0;
-    }
-  }
-
-  if (state == 7 && btn_set == 0)
-  { // state 7, reset factory setting
-    displayFactoryReset();
-  }
-  if (state == 7 && btn_set == 1)
-  {
-    displayFactoryResetConfirm();
-  }
-}
-
-void buttonMenu()
-{
-  if (btn_set == 0)
-  {
-    if (buttonRead(buttonUp) == true && state > 0)
-    {
-      state--;
-      lcd.clear();
-    }
-    if (buttonRead(buttonDown) == true && state < 7)
-    {
-      state++;
-      lcd.clear();
-    }
-    if (buttonRead(buttonSet) == true && state > 0)
-    {
-      btn_set = 1;
-      lcd.clear();
-    }
-  }
-
-  if (state == 1 && btn_set == 1)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      temperature.threshold = temperature.threshold + 0.1;
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      temperature.threshold = temperature.threshold - 0.1;
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      EEPROM.put(0, temperature.threshold);
-      EEPROM.commit();
-      btn_set = 0;
-    }
-  }
-
-  if (state == 2 && btn_set == 1)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      if (timer1.hour < 23)
-      {
-        timer1.hour++;
-      }
-      else
-      {
-        timer1.hour = 0;
-      }
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      if (timer1.hour > 0)
-      {
-        timer1.hour--;
-      }
-      else
-      {
-        timer1.hour = 23;
-      }
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      btn_set = 2;
-    }
-  }
-
-  if (state == 2 && btn_set == 2)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      if (timer1.minute < 59)
-      {
-        timer1.minute++;
-      }
-      else if (timer1.hour < 23)
-      {
-        timer1.minute = 0;
-        timer1.hour++;
-      }
-      else
-      {
-        timer1.minute = 0;
-        timer1.hour = 0;
-      }
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      if (timer1.minute > 0)
-      {
-        timer1.minute--;
-      }
-      else if (timer1.hour > 0)
-      {
-        timer1.minute = 59;
-        timer1.hour--;
-      }
-      else
-      {
-        timer1.minute = 59;
-        timer1.hour = 23;
-      }
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      btn_set = 3;
-    }
-  }
-
-  if (state == 2 && btn_set == 3)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      if (timer2.hour < 23)
-      {
-        timer2.hour++;
-      }
-      else
-      {
-        timer2.hour = 0;
-      }
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      if (timer2.hour > 0)
-      {
-        timer2.hour--;
-      }
-      else
-      {
-        timer2.hour = 23;
-      }
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      btn_set = 4;
-    }
-  }
-
-  if (state == 2 && btn_set == 4)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      if (timer2.minute < 59)
-      {
-        timer2.minute++;
-      }
-      else if (timer2.hour < 23)
-      {
-        timer2.minute = 0;
-        timer2.hour++;
-      }
-      else
-      {
-        timer2.minute = 0;
-        timer2.hour = 0;
-      }
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      if (timer2.minute > 0)
-      {
-        timer2.minute--;
-      }
-      else if (timer2.hour > 0)
-      {
-        timer2.minute = 59;
-        timer2.hour--;
-      }
-      else
-      {
-        timer2.minute = 59;
-        timer2.hour = 23;
-      }
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      btn_set = 5;
-    }
-  }
-
-  if (state == 2 && btn_set == 5)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      if (timer3.hour < 23)
-      {
-        timer3.hour++;
-      }
-      else
-      {
-        timer3.hour = 0;
-      }
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      if (timer3.hour > 0)
-      {
-        timer3.hour--;
-      }
-      else
-      {
-        timer3.hour = 23;
-      }
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      btn_set = 6;
-    }
-  }
-
-  if (state == 2 && btn_set == 6)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      if (timer3.minute < 59)
-      {
-        timer3.minute++;
-      }
-      else if (timer3.hour < 23)
-      {
-        timer3.minute = 0;
-        timer3.hour++;
-      }
-      else
-      {
-        timer3.minute = 0;
-        timer3.hour = 0;
-      }
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      if (timer3.minute > 0)
-      {
-        timer3.minute--;
-      }
-      else if (timer3.hour > 0)
-      {
-        timer3.minute = 59;
-        timer3.hour--;
-      }
-      else
-      {
-        timer3.minute = 59;
-        timer3.hour = 23;
-      }
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      EEPROM.put(6, timer1.hour);
-      EEPROM.put(7, timer1.minute);
-      EEPROM.put(9, timer2.hour);
-      EEPROM.put(10, timer2.minute);
-      EEPROM.put(12, timer3.hour);
-      EEPROM.put(13, timer3.minute);
-      EEPROM.commit();
-      btn_set = 0;
-    }
-  }
-
-  if (state == 3 && btn_set == 1)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      timer1.setting = 1;
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      timer1.setting = 0;
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      btn_set = 2;
-    }
-  }
-
-  if (state == 3 && btn_set == 2)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      timer2.setting = 1;
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      timer2.setting = 0;
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      btn_set = 3;
-    }
-  }
-
-  if (state == 3 && btn_set == 3)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      timer3.setting = 1;
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      timer3.setting = 0;
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      EEPROM.put(8, timer1.setting);
-      EEPROM.put(11, timer2.setting);
-      EEPROM.put(14, timer3.setting);
-      EEPROM.commit();
-      btn_set = 0;
-    }
-  }
-
-  if (state == 4 && btn_set == 1)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      if (deviceSet.duration < 60)
-      {
-        deviceSet.duration++;
-      }
-      else
-      {
-        deviceSet.duration = 1;
-      }
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      if (deviceSet.duration > 1)
-      {
-        deviceSet.duration--;
-      }
-      else
-      {
-        deviceSet.duration = 60;
-      }
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      EEPROM.put(5, deviceSet.duration);
-      EEPROM.commit();
-      btn_set = 0;
-    }
-  }
-
-  if (state == 5 && btn_set == 1)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      if (deviceSet.backlight > 0)
-      {
-        deviceSet.backlight--;
-      }
-      else
-      {
-        deviceSet.backlight = 0;
-      }
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      if (deviceSet.backlight < 4)
-      {
-        deviceSet.backlight++;
-      }
-      else
-      {
-        deviceSet.backlight = 4;
-      }
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      EEPROM.put(4, deviceSet.backlight);
-      EEPROM.commit();
-      btn_set = 0;
-    }
-  }
-
-  if (state == 6 && btn_set == 1)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      if (RTC.hour < 23)
-      {
-        RTC.hour++;
-      }
-      else
-      {
-        RTC.hour = 0;
-      }
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      if (RTC.hour > 0)
-      {
-        RTC.hour--;
-      }
-      else
-      {
-        RTC.hour = 23;
-      }
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      btn_set = 2;
-    }
-  }
-
-  if (state == 6 && btn_set == 2)
-  {
-    if (buttonRead(buttonUp) == true)
-    {
-      if (RTC.minute < 59)
-      {
-        RTC.minute++;
-      }
-      else if (RTC.hour < 23)
-      {
-        RTC.minute = 0;
-        RTC.hour++;
-      }
-      else
-      {
-        RTC.minute = 0;
-        RTC.hour = 0;
-      }
-    }
-    if (buttonRead(buttonDown) == true)
-    {
-      if (RTC.minute > 0)
-      {
-        RTC.minute--;
-      }
-      else if (RTC.hour > 0)
-      {
-        RTC.minute = 59;
-        RTC.hour--;
-      }
-      else
-      {
-        RTC.minute = 59;
-        RTC.hour = 23;
-      }
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      setDS3231time(00, RTC.minute, RTC.hour, 7, 01, 10, 22);
-      btn_set = 0;
-    }
-  }
-
-  if (state == 7 && btn_set == 1)
-  {
-    if (buttonRead(buttonUp) == true || buttonRead(buttonDown) == true)
-    {
-      lcd.clear();
-      btn_set = 0;
-    }
-    if (buttonRead(buttonSet) == true)
-    {
-      factoryReset();
-      lcd.clear();
-      lcd.setCursor(4, 0);
-      lcd.print("Success!");
-      delay(2000);
-      lcd.clear();
-      btn_set = 0;
-      state = 0;
-    }
-  }
-}
-
-// Web function ----------------------------------------------
-
-String statusTimer(byte status)
-{
-  if (status == 1)
-  {
-    return "On";
-  }
-  else
-    return "Off";
-}
-
-String concatTime(byte hour, byte minute)
-{
-  String hr, mnt, conc;
-  if (hour < 10)
-  {
-    hr = "0" + String(hour);
-  }
-  else
-  {
-    hr = String(hour);
-  }
-  if (minute < 10)
-  {
-    mnt = "0" + String(minute);
-  }
-  else
-  {
-    mnt = String(minute);
-  }
-  conc = hr + ":" + mnt;
-  return conc;
-}
-
-void setupServer()
-{
-  webServer.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send(LittleFS, "/index.html", "text/html", false); });
-
-  webServer.serveStatic("/", LittleFS, "/").setCacheControl("max-age=31536000"); // 365 days
-
-  webServer.on("/temp", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send_P(200, "text/plain", String(temperature.celcius).c_str()); });
-
-  webServer.on("/thresh", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send_P(200, "text/plain", String(temperature.threshold).c_str()); });
-
-  webServer.on("/time", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send_P(200, "text/plain", concatTime(RTC.hour, RTC.minute).c_str()); });
-
-  webServer.on("/timer1", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send_P(200, "text/plain", concatTime(timer1.hour, timer1.minute).c_str()); });
-
-  webServer.on("/timer1status", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send_P(200, "text/plain", statusTimer(timer1.setting).c_str()); });
-
-  webServer.on("/timer2", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send_P(200, "text/plain", concatTime(timer2.hour, timer2.minute).c_str()); });
-
-  webServer.on("/timer2status", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send_P(200, "text/plain", statusTimer(timer2.setting).c_str()); });
-
-  webServer.on("/timer3", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send_P(200, "text/plain", concatTime(timer3.hour, timer3.minute).c_str()); });
-
-  webServer.on("/timer3status", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send_P(200, "text/plain", statusTimer(timer3.setting).c_str()); });
-
-  webServer.on("/duration", HTTP_GET, [](AsyncWebServerRequest *request)
-               { request->send_P(200, "text/plain", String(deviceSet.duration).c_str()); });
+    buffer->busy = true; // sent from the buffer as it is, without a copy
+    request->onDisconnect([buffer]()
+                          { buffer->busy = false; });
+    request->send(request->beginResponse_P(200, "application/json", (const uint8_t *)buffer->text, out.used)); });
 
   webServer.on("/wifi", HTTP_POST, [](AsyncWebServerRequest *request)
                {
@@ -2211,11 +1940,11 @@ void setupServer()
             EEPROM.put(49 + i, deviceSet.pass[i]);
           }
           }
-        EEPROM.commit();
-        request->send(200, "text/html", "<p>Data diterima, alat akan restart.</p><p>Mohon tunggu beberapa saat, kemudian hubungkan kembali ke alat.</p>");
-        restart = true;
       }
-    } });
+    }
+    EEPROM.commit();
+    request->send_P(200, "text/html", pageRestart);
+    restart = true; });
 
   webServer.on("/settings", HTTP_POST, [](AsyncWebServerRequest *request)
                {
@@ -2224,77 +1953,127 @@ void setupServer()
       AsyncWebParameter* p = request->getParam(i);
       if(p->isPost()){
         if (p->name() == "TempThresh") {
-          String temp = p->value();
-          temp.replace(",", ".");
-          temperature.threshold = temp.toFloat();
-          EEPROM.put(0, temperature.threshold);
+          if (parseTemp(p->value().c_str(), &temperature.threshold)) {
+            EEPROM.put(0, temperature.threshold);
           }
-        if (p->name() == "timeT1") {
-          String temp1 = p->value();
-          String temp2 = temp1;
-          temp1 = temp1.substring(0,2);
-          temp2 = temp2.substring(3,5);
-          timer1.hour = byte(temp1.toInt());
-          timer1.minute = byte(temp2.toInt());
-          EEPROM.put(6, timer1.hour);
-          EEPROM.put(7, timer1.minute);
           }
-        if (p->name() == "statusT1") {
-          if (p->value() == "on"){
-            timer1.setting = 1;
+        if (p->name() == "resolution") {
+          byte bits = byte(p->value().toInt());
+          if (bits >= 9 && bits <= 12) {
+            deviceSet.resolution = bits;
+            EEPROM.put(114, deviceSet.resolution);
           }
-          else if (p->value() == "off"){
-            timer1.setting = 0;
           }
-          EEPROM.put(8, timer1.setting);
+        if (p->name().length() == 5 && strncmp(p->name().c_str(), "role", 4) == 0) {
+          byte sensor = p->name().c_str()[4] - '0';
+          byte role = byte(p->value().toInt());
+          if (sensor < LINK_MAX_SENSORS && role <= LINK_ROLE_OFF) {
+            deviceSet.roles = (deviceSet.roles & ~(0x03 << (sensor * 2))) | (role << (sensor * 2));
+            EEPROM.put(115, deviceSet.roles);
           }
-        if (p->name() == "timeT2") {
-          String temp1 = p->value();
-          String temp2 = temp1;
-          temp1 = temp1.substring(0,2);
-          temp2 = temp2.substring(3,5);
-          timer2.hour = byte(temp1.toInt());
-          timer2.minute = byte(temp2.toInt());
-          EEPROM.put(9, timer2.hour);
-          EEPROM.put(10, timer2.minute);
           }
-          if (p->name() == "statusT2") {
-          if (p->value() == "on"){
-            timer2.setting = 1;
+        if (p->name() == "hysteresis") {
+          int16_t band;
+          if (parseTemp(p->value().c_str(), &band) && band >= 0 && band <= LINK_HYSTERESIS_MAX) {
+            temperature.hysteresis = band;
+            EEPROM.put(116, temperature.hysteresis);
           }
-          else if (p->value() == "off"){
-            timer2.setting = 0;
           }
-          EEPROM.put(11, timer2.setting);
+        if (p->name() == "minOn") {
+          deviceSet.minOn = constrain(p->value().toInt(), 0, LINK_MIN_TIME_MAX);
+          EEPROM.put(118, deviceSet.minOn);
+          }
+        if (p->name() == "minOff") {
+          deviceSet.minOff = constrain(p->value().toInt(), 0, LINK_MIN_TIME_MAX);
+          EEPROM.put(120, deviceSet.minOff);
+          }
+        if (p->name() == "filter") {
+          byte filter = byte(p->value().toInt());
+          if (filter <= LINK_FILTER_MAX) {
+            deviceSet.filter = filter;
+            EEPROM.put(122, deviceSet.filter);
           }
-        if (p->name() == "timeT3") {
-          String temp1 = p->value();
-          String temp2 = temp1;
-          temp1 = temp1.substring(0,2);
-          temp2 = temp2.substring(3,5);
-          timer3.hour = byte(temp1.toInt());
-          timer3.minute = byte(temp2.toInt());
-          EEPROM.put(12, timer3.hour);
-          EEPROM.put(13, timer3.minute);
           }
-          if (p->name() == "statusT3") {
+        if (p->name() == "merge" || p->name() == "preempt" || p->name() == "timerFirst") {
+          byte flag = (p->name() == "merge") ? LINK_POLICY_MERGE : (p->name() == "preempt") ? LINK_POLICY_PREEMPT : LINK_POLICY_TIMER_FIRST;
           if (p->value() == "on"){
-            timer3.setting = 1;
+            deviceSet.policy |= flag;
           }
           else if (p->value() == "off"){
-            timer3.setting = 0;
+            deviceSet.policy &= ~flag;
           }
-          EEPROM.put(14, timer3.setting);
+          EEPROM.put(123, deviceSet.policy);
+          }
+        if (p->name() == "deadline") {
+          deviceSet.deadline = constrain(p->value().toInt(), 0, 255);
+          EEPROM.put(124, deviceSet.deadline);
           }
         if (p->name() == "duration") {
-          String temp = p->value();
-          deviceSet.duration = byte(temp.toInt());
+          deviceSet.duration = constrain(p->value().toInt(), LINK_DURATION_MIN, LINK_DURATION_MAX);
           EEPROM.put(5, deviceSet.duration);
           }
-        EEPROM.commit();
-        request->send(200, "text/html", "<p>Data telah diterima dan disimpan, untuk kembali ke laman utama klik <a href=\"http://192.168.1.1\">disini</a>.</p>");
       }
-    } });
+    }
+    EEPROM.commit();
+    request->send_P(200, "text/html", pageSaved); });
+
+  webServer.on("/schedule", HTTP_POST, [](AsyncWebServerRequest *request)
+               {
+    // every row starts with "time", the "on", "end", "every", "days", "from" and "to" after it belong to that row;
+    // the old table stays if nothing parses
+    link_slot table[LINK_MAX_SLOTS];
+    byte count = 0;
+    uint16_t value;
+    int params = request->params();
+    for (int i=0; i<params; i++){
+      AsyncWebParameter* p = request->getParam(i);
+      if(p->isPost()){
+        link_slot *row = (count > 0) ? &table[count - 1] : NULL;
+        if (p->name() == "time" && count < LINK_MAX_SLOTS && parseClock(p->value().c_str(), &value)) {
+          table[count++] = linkSlot(value, false);
+          }
+        else if (row == NULL) {
+          continue;
+          }
+        if (p->name() == "on" && p->value() == "1") {
+          row->start |= LINK_SLOT_ON;
+          }
+        if (p->name() == "end" && parseClock(p->value().c_str(), &value)) {
+          row->end = value;
+          }
+        if (p->name() == "every") {
+          row->every = constrain(p->value().toInt(), 0, 255);
+          }
+        if (p->name() == "days") {
+          byte days = p->value().toInt() & LINK_DAYS_ALL;
+          row->days = (days != 0) ? days : LINK_DAYS_ALL;
+          }
+        if (p->name() == "from" && parseDate(p->value().c_str(), &value)) {
+          row->from = value;
+          }
+        if (p->name() == "to" && parseDate(p->value().c_str(), &value)) {
+          row->to = value;
+          }
+      }
+    }
+    for (byte i = 0; i < count; i++){
+      if (table[i].every == 0 || table[i].end <= LINK_SLOT_MINUTE(table[i])) {
+        table[i].every = 0;
+        table[i].end = LINK_SLOT_MINUTE(table[i]);
+        }
+      if (table[i].to == 0) {
+        table[i].from = 0;
+        }
+    }
+    if (count > 0 || request->hasParam("clear", true)) {
+      memcpy(schedule, table, count * sizeof(link_slot));
+      scheduleCount = count;
+      linkScheduleSort(schedule, scheduleCount);
+      saveSchedule();
+      EEPROM.commit();
+      scheduleSynced = false;
+    }
+    request->send_P(200, "text/html", pageSaved); });
 
   webServer.on("/RTC", HTTP_POST, [](AsyncWebServerRequest *request)
                {
@@ -2302,18 +2081,26 @@ void setupServer()
     for (int i=0; i<params; i++){
       AsyncWebParameter* p = request->getParam(i);
       if(p->isPost()){
-        if (p->name() == "RTC") {
-          String temp1 = p->value();
-          String temp2 = temp1;
-          temp1 = temp1.substring(0,2);
-          temp2 = temp2.substring(3,5);
-          RTC.hour = byte(temp1.toInt());
-          RTC.minute = byte(temp2.toInt());
-          setDS3231time(00, RTC.minute, RTC.hour, 7, 01, 10, 22);
+        if (p->name() == "date") {
+          // "YYYY-MM-DD" from the browser, comes before "RTC" in the form; without it the date is kept
+          unsigned int year, month, day;
+          if (sscanf(p->value().c_str(), "%4u-%2u-%2u", &year, &month, &day) == 3 && year >= 2000 && year < 2100 &&
+              month >= 1 && month <= 12 && day >= 1 && day <= linkDaysInMonth(month, year % 100)) {
+            RTC.year = year % 100;
+            RTC.month = month;
+            RTC.dayOfMonth = day;
+            RTC.dayOfWeek = linkDayOfWeek(day, month, year % 100);
+            }
+          }
+        uint16_t minute;
+        if (p->name() == "RTC" && parseClock(p->value().c_str(), &minute)) {
+          RTC.hour = minute / 60;
+          RTC.minute = minute % 60;
+          setDS3231time(00, RTC.minute, RTC.hour, RTC.dayOfWeek, RTC.dayOfMonth, RTC.month, RTC.year);
           }
-        request->send(200, "text/html", "<p>Data telah diterima dan disimpan, untuk kembali ke laman utama klik <a href=\"http://192.168.1.1\">disini</a>.</p>");
       }
-    } });
+    }
+    request->send_P(200, "text/html", pageSaved); });
 }
 
 // Main function ---------------------------------------------
@@ -2321,23 +2108,23 @@ void setupServer()
 void setup()
 {
   LittleFS.begin();
-  Serial.begin(9600);
+  Serial.begin(9600, SERIAL_8N1, SERIAL_TX_ONLY); // RX pin takes the RTC square wave
   EEPROM.begin(EEPROM_SIZE);
   fetchEEPROM();
   Wire.begin(1);
-  pinMode(buttonUp, INPUT_PULLUP);
-  pinMode(buttonDown, INPUT_PULLUP);
-  pinMode(buttonSet, INPUT_PULLUP);
+  Wire.setClock(I2C_CLOCK);
+  setupDS3231();
+  updateClock();
+  setupButtons();
   lcd.init();
   lcd.backlight();
   lcd.createChar(0, charDegree);
-  lcd.createChar(1, charT1);
-  lcd.createChar(2, charT2);
-  lcd.createChar(3, charT3);
-  lcd.setCursor(0, 0);
-  lcd.print("Multitechnologi");
+  lcd.createChar(1, charTimer);
+  frame.setCursor(0, 0);
+  frame.print("Multitechnologi");
+  showFrame();
   delay(3000);
-  lcd.clear();
+  frame.clear();
   WiFi.mode(WIFI_AP);
   WiFi.softAPConfig(APIP, APIP, subnet_mask);
   WiFi.softAP(deviceSet.ssid, deviceSet.pass);
@@ -2345,15 +2132,21 @@ void setup()
   dnsServer.start(DNS_PORT, "*", WiFi.softAPIP());
   webServer.addHandler(new CaptiveRequestHandler()).setFilter(ON_AP_FILTER);
   webServer.begin();
+  counter_heartbeat = millis() - HEARTBEAT_INTERVAL; // full sync on the first loop pass
+  readRegisters(LINK_REG(version), sizeof(aux.version));
+  trackHeap(); // baseline
 }
 
 void loop()
 {
+  updateClock();
   receiveStatus();
   buttonMenu();
   displayMenu();
   backlightMode();
-  sendSettings();
+  syncSettings();
+  pushStatus();
+  trackHeap();
   dnsServer.processNextRequest();
   if (restart)
   {
@@ -0,0 +1,114 @@
+#include <unity.h>
+#include <Buttons.h>
+
+#define UP 0x01  // repeat button, id 1
+#define SET 0x04 // press on release, id 3
+
+static Buttons buttons(0x03);
+
+static void hold(uint8_t down, uint16_t samples)
+{
+  while (samples--)
+  {
+    buttons.sample(down);
+  }
+}
+
+void setUp(void)
+{
+  buttons = Buttons(0x03);
+}
+
+void tearDown(void)
+{
+}
+
+void test_press_needs_a_stable_level(void)
+{
+  hold(UP, BUTTON_DEBOUNCE - 1);
+  TEST_ASSERT_EQUAL(0, buttons.read());
+  hold(UP, 1);
+  TEST_ASSERT_EQUAL(BUTTON_PRESS | 1, buttons.read());
+  TEST_ASSERT_EQUAL(0, buttons.read());
+}
+
+void test_bounce_is_ignored(void)
+{
+  for (uint8_t i = 0; i < 20; i++)
+  {
+    buttons.sample(i & 1 ? UP : 0);
+  }
+  TEST_ASSERT_EQUAL(0, buttons.read());
+}
+
+void test_held_arrow_repeats_faster(void)
+{
+  hold(UP, BUTTON_DEBOUNCE);
+  buttons.read();
+  hold(UP, BUTTON_REPEAT_DELAY - 1);
+  TEST_ASSERT_EQUAL(0, buttons.read());
+  hold(UP, 1);
+  TEST_ASSERT_EQUAL(BUTTON_REPEAT | 1, buttons.read());
+  uint8_t repeats = 0;
+  for (uint16_t i = 0; i < 600; i++) // 3 s
+  {
+    buttons.sample(UP);
+    while (buttons.read() == (BUTTON_REPEAT | 1))
+    {
+      repeats++;
+    }
+  }
+  TEST_ASSERT_TRUE(repeats > 600 / BUTTON_REPEAT_START); // sped up past the starting rate
+  TEST_ASSERT_TRUE(repeats <= 600 / BUTTON_REPEAT_MIN);
+  hold(0, BUTTON_DEBOUNCE);
+  TEST_ASSERT_EQUAL(0, buttons.read()); // no event on release
+}
+
+void test_set_short_press_on_release(void)
+{
+  hold(SET, 50);
+  TEST_ASSERT_EQUAL(0, buttons.read());
+  hold(0, BUTTON_DEBOUNCE);
+  TEST_ASSERT_EQUAL(BUTTON_PRESS | 3, buttons.read());
+}
+
+void test_set_long_press_once(void)
+{
+  hold(SET, BUTTON_DEBOUNCE + BUTTON_LONG + 50);
+  TEST_ASSERT_EQUAL(BUTTON_LONG_PRESS | 3, buttons.read());
+  TEST_ASSERT_EQUAL(0, buttons.read());
+  hold(0, BUTTON_DEBOUNCE);
+  TEST_ASSERT_EQUAL(0, buttons.read()); // no short press after a long one
+}
+
+void test_clear_forgets_queued_events(void)
+{
+  hold(UP, BUTTON_DEBOUNCE);
+  buttons.clear();
+  TEST_ASSERT_EQUAL(0, buttons.read());
+}
+
+void test_full_queue_counts_dropped(void)
+{
+  hold(UP, 2000); // nobody reads
+  TEST_ASSERT_TRUE(buttons.dropped() > 0);
+  uint8_t queued = 0;
+  while (buttons.read())
+  {
+    queued++;
+  }
+  TEST_ASSERT_EQUAL(BUTTON_QUEUE - 1, queued);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_press_needs_a_stable_level);
+  RUN_TEST(test_bounce_is_ignored);
+  RUN_TEST(test_held_arrow_repeats_faster);
+  RUN_TEST(test_set_short_press_on_release);
+  RUN_TEST(test_set_long_press_once);
+  RUN_TEST(test_clear_forgets_queued_events);
+  RUN_TEST(test_full_queue_counts_dropped);
+  return UNITY_END();
+}
@@ -0,0 +1,124 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <LcdFrame.h>
+
+// Records what flush() sends, a cursor move as @col,row
+struct FakeDisplay
+{
+  char log[128];
+  size_t used;
+
+  void reset()
+  {
+    log[0] = '\0';
+    used = 0;
+  }
+
+  void setCursor(uint8_t col, uint8_t row)
+  {
+    used += snprintf(log + used, sizeof(log) - used, "@%u,%u", col, row);
+  }
+
+  void write(uint8_t c)
+  {
+    used += snprintf(log + used, sizeof(log) - used, "%c", c);
+  }
+};
+
+static LcdFrame frame;
+static FakeDisplay lcd;
+
+void setUp(void)
+{
+  frame = LcdFrame();
+  frame.flush(lcd); // display now known to be blank
+  lcd.reset();
+}
+
+void tearDown(void)
+{
+}
+
+void test_first_flush_sends_every_cell(void)
+{
+  LcdFrame fresh;
+  TEST_ASSERT_EQUAL(LcdFrame::COLS * LcdFrame::ROWS, fresh.dirty());
+  TEST_ASSERT_EQUAL(2 + LcdFrame::COLS * LcdFrame::ROWS, fresh.flush(lcd)); // one cursor move per row
+  TEST_ASSERT_EQUAL(0, fresh.dirty());
+}
+
+void test_unchanged_frame_sends_nothing(void)
+{
+  frame.setCursor(0, 0);
+  frame.print(" ");
+  TEST_ASSERT_EQUAL(0, frame.dirty());
+  TEST_ASSERT_EQUAL(0, frame.flush(lcd));
+  TEST_ASSERT_EQUAL_STRING("", lcd.log);
+}
+
+void test_run_of_changed_cells_moves_once(void)
+{
+  frame.setCursor(4, 1);
+  frame.print("abc");
+  TEST_ASSERT_EQUAL(3, frame.dirty());
+  TEST_ASSERT_EQUAL(4, frame.flush(lcd));
+  TEST_ASSERT_EQUAL_STRING("@4,1abc", lcd.log);
+}
+
+void test_single_clean_cell_is_rewritten(void)
+{
+  frame.setCursor(2, 0);
+  frame.print("XpY");
+  frame.flush(lcd);
+  lcd.reset();
+  frame.setCursor(2, 0);
+  frame.print("ApB"); // p unchanged
+  frame.setCursor(10, 0);
+  frame.print("Z");
+  TEST_ASSERT_EQUAL(3, frame.dirty());
+  frame.flush(lcd);
+  TEST_ASSERT_EQUAL_STRING("@2,0ApB@10,0Z", lcd.log);
+}
+
+void test_invalidate_resends_everything(void)
+{
+  frame.invalidate();
+  TEST_ASSERT_EQUAL(LcdFrame::COLS * LcdFrame::ROWS, frame.dirty());
+}
+
+void test_write_past_the_last_column_is_dropped(void)
+{
+  frame.setCursor(14, 0);
+  TEST_ASSERT_EQUAL(2, frame.print("xyz"));
+  TEST_ASSERT_EQUAL('x', frame.at(14, 0));
+  TEST_ASSERT_EQUAL('y', frame.at(15, 0));
+  TEST_ASSERT_EQUAL(' ', frame.at(0, 1)); // no wrap onto the next row
+}
+
+void test_print_numbers(void)
+{
+  frame.setCursor(0, 0);
+  frame.print((unsigned char)7);
+  frame.print(-12);
+  frame.print(30000UL);
+  char row[LcdFrame::COLS + 1] = {0};
+  for (uint8_t c = 0; c < LcdFrame::COLS; c++)
+  {
+    row[c] = frame.at(c, 0);
+  }
+  TEST_ASSERT_EQUAL_STRING("7-1230000       ", row);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_flush_sends_every_cell);
+  RUN_TEST(test_unchanged_frame_sends_nothing);
+  RUN_TEST(test_run_of_changed_cells_moves_once);
+  RUN_TEST(test_single_clean_cell_is_rewritten);
+  RUN_TEST(test_invalidate_resends_everything);
+  RUN_TEST(test_write_past_the_last_column_is_dropped);
+  RUN_TEST(test_print_numbers);
+  return UNITY_END();
+}
@@ -0,0 +1,242 @@
+#include <unity.h>
+#include <string.h>
+#include <SprayLink.h>
+
+static link_settings sample()
+{
+  link_settings settings;
+  memset(&settings, 0, sizeof(settings));
+  settings.threshold = 3050;
+  settings.duration = 5;
+  settings.resolution = 12;
+  settings.hysteresis = 50;
+  settings.minOn = 60;
+  settings.minOff = 60;
+  settings.filter = 2;
+  settings.policy = LINK_POLICY_MERGE;
+  settings.deadline = 30;
+  return settings;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_pack_parse_round_trip(void)
+{
+  link_settings settings = sample();
+  uint8_t buffer[LINK_MAX_FRAME];
+  uint8_t n = linkPack(buffer, LINK_MSG_SETTINGS, 7, &settings, sizeof(settings));
+  TEST_ASSERT_EQUAL(LINK_FRAME_SIZE(sizeof(settings)), n);
+  link_frame frame;
+  TEST_ASSERT_EQUAL(LINK_OK, linkParse(buffer, n, &frame));
+  TEST_ASSERT_EQUAL(LINK_VERSION, frame.version);
+  TEST_ASSERT_EQUAL(7, frame.seq);
+  TEST_ASSERT_TRUE(frame.payload == buffer + LINK_HEADER_SIZE); // no copy
+  const link_settings *got = linkPayload<link_settings>(&frame, LINK_MSG_SETTINGS);
+  TEST_ASSERT_TRUE(got != NULL);
+  TEST_ASSERT_EQUAL_MEMORY(&settings, got, sizeof(settings));
+}
+
+void test_payload_type_and_size_checked(void)
+{
+  link_time time = {0, 30, 6, 2, 17, 10, 26};
+  uint8_t buffer[LINK_MAX_FRAME];
+  uint8_t n = linkPack(buffer, LINK_MSG_TIME, 0, &time, sizeof(time));
+  link_frame frame;
+  TEST_ASSERT_EQUAL(LINK_OK, linkParse(buffer, n, &frame));
+  TEST_ASSERT_TRUE(linkPayload<link_settings>(&frame, LINK_MSG_TIME) == NULL); // wrong size
+  TEST_ASSERT_TRUE(linkPayload<link_time>(&frame, LINK_MSG_SETTINGS) == NULL); // wrong type
+  TEST_ASSERT_TRUE(linkPayload<link_time>(&frame, LINK_MSG_TIME) != NULL);
+}
+
+void test_oversized_payload_not_packed(void)
+{
+  uint8_t payload[LINK_MAX_PAYLOAD + 1] = {0};
+  uint8_t buffer[LINK_MAX_FRAME + 1];
+  TEST_ASSERT_EQUAL(0, linkPack(buffer, LINK_MSG_SETTINGS, 0, payload, sizeof(payload)));
+  TEST_ASSERT_EQUAL(LINK_MAX_FRAME, linkPack(buffer, LINK_MSG_SETTINGS, 0, payload, LINK_MAX_PAYLOAD));
+}
+
+void test_short_frames_rejected(void)
+{
+  link_settings settings = sample();
+  uint8_t buffer[LINK_MAX_FRAME];
+  uint8_t n = linkPack(buffer, LINK_MSG_SETTINGS, 0, &settings, sizeof(settings));
+  link_frame frame;
+  TEST_ASSERT_EQUAL(LINK_SHORT, linkParse(buffer, LINK_HEADER_SIZE, &frame)); // no crc
+  TEST_ASSERT_EQUAL(LINK_SHORT, linkParse(buffer, n - 1, &frame));            // cut payload
+  buffer[3] = LINK_MAX_PAYLOAD + 1;                                           // declared length too long
+  TEST_ASSERT_EQUAL(LINK_SHORT, linkParse(buffer, n, &frame));
+}
+
+void test_overflow_rejected(void)
+{
+  uint8_t buffer[LINK_MAX_FRAME + 1] = {LINK_VERSION};
+  link_frame frame;
+  TEST_ASSERT_EQUAL(LINK_OVERFLOW, linkParse(buffer, sizeof(buffer), &frame));
+}
+
+void test_bad_version_and_crc_rejected(void)
+{
+  link_settings settings = sample();
+  uint8_t buffer[LINK_MAX_FRAME];
+  uint8_t n = linkPack(buffer, LINK_MSG_SETTINGS, 0, &settings, sizeof(settings));
+  link_frame frame;
+  buffer[LINK_HEADER_SIZE + 1] ^= 0x10; // one flipped payload bit
+  TEST_ASSERT_EQUAL(LINK_BAD_CRC, linkParse(buffer, n, &frame));
+  buffer[LINK_HEADER_SIZE + 1] ^= 0x10;
+  buffer[0] = LINK_VERSION + 1;
+  TEST_ASSERT_EQUAL(LINK_BAD_VERSION, linkParse(buffer, n, &frame));
+}
+
+void test_delta_round_trip(void)
+{
+  link_settings last = sample();
+  link_settings now = last;
+  uint8_t payload[LINK_MAX_PAYLOAD];
+  TEST_ASSERT_EQUAL(0, linkPackDelta(payload, &now, &last)); // nothing changed
+  now.threshold = 3200;
+  now.deadline = 0;
+  uint8_t len = linkPackDelta(payload, &now, &last);
+  TEST_ASSERT_EQUAL(2 + sizeof(int16_t) + sizeof(uint8_t), len);
+  link_settings applied = last;
+  TEST_ASSERT_TRUE(linkApplyDelta(&applied, payload, len));
+  TEST_ASSERT_EQUAL_MEMORY(&now, &applied, sizeof(now));
+}
+
+void test_malformed_delta_rejected(void)
+{
+  link_settings last = sample();
+  link_settings now = last;
+  now.duration = 10;
+  uint8_t payload[LINK_MAX_PAYLOAD];
+  uint8_t len = linkPackDelta(payload, &now, &last);
+  link_settings applied = last;
+  TEST_ASSERT_FALSE(linkApplyDelta(&applied, payload, len - 1)); // length does not match the mask
+  TEST_ASSERT_FALSE(linkApplyDelta(&applied, payload, 1));
+  payload[1] = 0x80; // field past LINK_FIELD_COUNT
+  TEST_ASSERT_FALSE(linkApplyDelta(&applied, payload, len));
+  TEST_ASSERT_EQUAL_MEMORY(&last, &applied, sizeof(last)); // untouched
+}
+
+void test_pointer_bounds(void)
+{
+  link_pointer pointer = {LINK_REG(status), sizeof(link_status)};
+  TEST_ASSERT_TRUE(linkPointerValid(&pointer));
+  pointer.len = 0;
+  TEST_ASSERT_FALSE(linkPointerValid(&pointer));
+  pointer.reg = sizeof(link_registers) - 1;
+  pointer.len = 2; // past the end of the map
+  TEST_ASSERT_FALSE(linkPointerValid(&pointer));
+  pointer.reg = 0;
+  pointer.len = LINK_MAX_PAYLOAD; // no room for the register address
+  TEST_ASSERT_FALSE(linkPointerValid(&pointer));
+}
+
+void test_schedule_chunks_swap_in_when_complete(void)
+{
+  link_slot table[5];
+  for (uint8_t i = 0; i < 5; i++)
+  {
+    table[i] = linkSlot(360 + i * 60, true);
+  }
+  link_slot received[LINK_MAX_SLOTS];
+  link_schedule_rx rx = {0, 0, 0};
+  uint8_t count = 0;
+  uint8_t payload[LINK_MAX_PAYLOAD];
+  for (int8_t first = 4; first >= 0; first -= LINK_SLOTS_PER_CHUNK)
+  { // any order, the table is whole once every chunk is in
+    uint8_t chunk = first - first % LINK_SLOTS_PER_CHUNK;
+    TEST_ASSERT_EQUAL(0, count);
+    uint8_t len = linkPackSchedule(payload, table, 5, chunk);
+    TEST_ASSERT_TRUE(linkApplySchedule(&rx, received, &count, payload, len));
+  }
+  TEST_ASSERT_EQUAL(5, count);
+  TEST_ASSERT_EQUAL_MEMORY(table, received, sizeof(table));
+}
+
+void test_malformed_schedule_chunk_rejected(void)
+{
+  link_slot table[2] = {linkSlot(360, true), linkSlot(720, true)};
+  link_slot received[LINK_MAX_SLOTS];
+  link_schedule_rx rx = {0, 0, 0};
+  uint8_t count = 0;
+  uint8_t payload[LINK_MAX_PAYLOAD];
+  uint8_t len = linkPackSchedule(payload, table, 2, 0);
+  TEST_ASSERT_FALSE(linkApplySchedule(&rx, received, &count, payload, len - 1)); // partial slot
+  payload[0] = LINK_MAX_SLOTS + 1;                                          // table too big
+  TEST_ASSERT_FALSE(linkApplySchedule(&rx, received, &count, payload, len));
+  TEST_ASSERT_EQUAL(0, count);
+}
+
+void test_schedule_mix_of_old_and_new_slots_not_taken(void)
+{
+  link_slot table[4] = {linkSlot(360, true), linkSlot(420, true), linkSlot(480, true), linkSlot(540, true)};
+  link_slot received[LINK_MAX_SLOTS];
+  memcpy(received, table, sizeof(table)); // the old table already matches the new CRC
+  link_schedule_rx rx = {0, 0, 0};
+  uint8_t count = 0;
+  uint8_t payload[LINK_MAX_PAYLOAD];
+  uint8_t len = linkPackSchedule(payload, table, 4, 0);
+  TEST_ASSERT_TRUE(linkApplySchedule(&rx, received, &count, payload, len));
+  TEST_ASSERT_EQUAL(0, count); // second chunk still missing
+  len = linkPackSchedule(payload, table, 4, LINK_SLOTS_PER_CHUNK);
+  TEST_ASSERT_TRUE(linkApplySchedule(&rx, received, &count, payload, len));
+  TEST_ASSERT_EQUAL(4, count);
+}
+
+void test_schedule_chunks_of_another_table_start_over(void)
+{
+  link_slot old[4] = {linkSlot(360, true), linkSlot(420, true), linkSlot(480, true), linkSlot(540, true)};
+  link_slot table[4] = {linkSlot(60, true), linkSlot(120, true), linkSlot(180, true), linkSlot(240, true)};
+  link_slot received[LINK_MAX_SLOTS];
+  link_schedule_rx rx = {0, 0, 0};
+  uint8_t count = 0;
+  uint8_t payload[LINK_MAX_PAYLOAD];
+  uint8_t len = linkPackSchedule(payload, old, 4, 0);
+  linkApplySchedule(&rx, received, &count, payload, len); // burst cut short
+  len = linkPackSchedule(payload, table, 4, LINK_SLOTS_PER_CHUNK);
+  linkApplySchedule(&rx, received, &count, payload, len);
+  TEST_ASSERT_EQUAL(0, count);
+  len = linkPackSchedule(payload, table, 4, 0);
+  linkApplySchedule(&rx, received, &count, payload, len);
+  TEST_ASSERT_EQUAL(4, count);
+  TEST_ASSERT_EQUAL_MEMORY(table, received, sizeof(table));
+}
+
+void test_empty_schedule_applies(void)
+{
+  link_slot received[LINK_MAX_SLOTS];
+  link_schedule_rx rx = {0, 0, 0};
+  uint8_t count = 0xFF;
+  uint8_t payload[LINK_MAX_PAYLOAD];
+  link_slot none[1] = {linkSlot(360, true)};
+  uint8_t len = linkPackSchedule(payload, none, 0, 0);
+  TEST_ASSERT_TRUE(linkApplySchedule(&rx, received, &count, payload, len));
+  TEST_ASSERT_EQUAL(0, count);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_pack_parse_round_trip);
+  RUN_TEST(test_payload_type_and_size_checked);
+  RUN_TEST(test_oversized_payload_not_packed);
+  RUN_TEST(test_short_frames_rejected);
+  RUN_TEST(test_overflow_rejected);
+  RUN_TEST(test_bad_version_and_crc_rejected);
+  RUN_TEST(test_delta_round_trip);
+  RUN_TEST(test_malformed_delta_rejected);
+  RUN_TEST(test_pointer_bounds);
+  RUN_TEST(test_schedule_chunks_swap_in_when_complete);
+  RUN_TEST(test_malformed_schedule_chunk_rejected);
+  RUN_TEST(test_schedule_mix_of_old_and_new_slots_not_taken);
+  RUN_TEST(test_schedule_chunks_of_another_table_start_over);
+  RUN_TEST(test_empty_schedule_applies);
+  return UNITY_END();
+}
@@ -0,0 +1,195 @@
+#include <unity.h>
+#include <SprayLink.h>
+
+// Saturday 2026-10-17, DS3231 day of the week 7
+static link_time at(uint8_t hour, uint8_t minute, uint8_t day = 17, uint8_t dayOfWeek = 7)
+{
+  link_time time = {0, minute, hour, dayOfWeek, day, 10, 26};
+  return time;
+}
+
+static link_slot table[3];
+static uint8_t count;
+static link_schedule_cursor cursor;
+
+void setUp(void)
+{
+  table[0] = linkSlot(6 * 60, true);       // 06:00
+  table[1] = linkSlot(12 * 60, true);      // 12:00
+  table[2] = linkSlot(23 * 60 + 59, true); // 23:59
+  count = 3;
+  cursor.valid = false;
+}
+
+void tearDown(void)
+{
+}
+
+static uint16_t step(uint8_t hour, uint8_t minute, uint8_t day = 17, uint8_t dayOfWeek = 7)
+{
+  link_time now = at(hour, minute, day, dayOfWeek);
+  return linkScheduleStep(&cursor, table, count, &now);
+}
+
+void test_first_step_only_sets_the_cursor(void)
+{
+  TEST_ASSERT_EQUAL(0, step(6, 0)); // nothing known about the minutes before
+  TEST_ASSERT_EQUAL(0, step(6, 0));
+}
+
+void test_fires_on_the_minute(void)
+{
+  step(5, 59);
+  TEST_ASSERT_EQUAL(1 << 0, step(6, 0));
+}
+
+void test_catch_up_after_missed_minutes(void)
+{
+  step(5, 58);
+  TEST_ASSERT_EQUAL(1 << 0, step(6, 2)); // 05:59-06:01 never evaluated
+  TEST_ASSERT_EQUAL(0, step(6, 3));
+}
+
+void test_same_minute_fires_once(void)
+{
+  step(5, 59);
+  TEST_ASSERT_EQUAL(1 << 0, step(6, 0));
+  TEST_ASSERT_EQUAL(0, step(6, 0)); // a spray shorter than a minute ends inside it
+  TEST_ASSERT_EQUAL(0, step(6, 0));
+  TEST_ASSERT_EQUAL(0, step(6, 1));
+}
+
+void test_small_step_back_does_not_fire_again(void)
+{
+  step(5, 59);
+  TEST_ASSERT_EQUAL(1 << 0, step(6, 0));
+  TEST_ASSERT_EQUAL(0, step(5, 58)); // clock corrected back two minutes
+  TEST_ASSERT_EQUAL(0, step(5, 59));
+  TEST_ASSERT_EQUAL(0, step(6, 0));
+  TEST_ASSERT_EQUAL(0, step(6, 1));
+}
+
+void test_step_forward_skips(void)
+{
+  step(5, 30);
+  TEST_ASSERT_EQUAL(0, step(6, 30)); // clock set forward an hour, 06:00 never came
+  TEST_ASSERT_EQUAL(0, step(6, 31));
+}
+
+void test_large_step_back_restarts(void)
+{
+  step(12, 30);
+  TEST_ASSERT_EQUAL(0, step(11, 30)); // set back an hour, nothing fires on the step itself
+  step(11, 59);
+  TEST_ASSERT_EQUAL(1 << 1, step(12, 0)); // the replayed hour runs again
+}
+
+void test_catch_up_replays_every_missed_rule(void)
+{
+  table[1] = linkSlot(6 * 60 + 1, true); // 06:00 and 06:01 both in the gap
+  step(5, 58);
+  TEST_ASSERT_EQUAL(1 << 0 | 1 << 1, step(6, 2));
+  TEST_ASSERT_EQUAL(0, step(6, 3));
+}
+
+void test_midnight_wrap_uses_yesterday(void)
+{
+  table[2].days = LINK_DAY(7); // Saturdays only
+  step(23, 58);
+  TEST_ASSERT_EQUAL(1 << 2, step(0, 1, 18, 1)); // Sunday now, the 23:59 run was Saturday's
+}
+
+void test_midnight_wrap_wrong_day(void)
+{
+  table[2].days = LINK_DAY(1); // Sundays only
+  step(23, 58);
+  TEST_ASSERT_EQUAL(0, step(0, 1, 18, 1));
+}
+
+void test_midnight_wrap_fires_both_days(void)
+{
+  table[0] = linkSlot(0, true); // yesterday's 23:59 and today's 00:00 both in the gap
+  step(23, 58);
+  TEST_ASSERT_EQUAL(1 << 0 | 1 << 2, step(0, 1, 18, 1));
+}
+
+void test_interval_rule_catch_up(void)
+{
+  table[0].every = 15;
+  table[0].end = 7 * 60; // 06:00, 06:15 ... 07:00
+  step(6, 13);
+  TEST_ASSERT_EQUAL(1 << 0, step(6, 16));
+  TEST_ASSERT_EQUAL(0, step(6, 17));
+  step(6, 59);
+  TEST_ASSERT_EQUAL(1 << 0, step(7, 0));
+  step(7, 14);
+  TEST_ASSERT_EQUAL(0, step(7, 15)); // past end
+}
+
+void test_disabled_rule_never_fires(void)
+{
+  table[0].start &= ~LINK_SLOT_ON;
+  step(5, 59);
+  TEST_ASSERT_EQUAL(0, step(6, 0));
+}
+
+void test_find_returns_the_first_rule_at_or_after(void)
+{
+  TEST_ASSERT_EQUAL(0, linkScheduleFind(table, count, 0));
+  TEST_ASSERT_EQUAL(0, linkScheduleFind(table, count, 6 * 60));
+  TEST_ASSERT_EQUAL(1, linkScheduleFind(table, count, 6 * 60 + 1));
+  TEST_ASSERT_EQUAL(2, linkScheduleFind(table, count, 23 * 60 + 59));
+  TEST_ASSERT_EQUAL(count, linkScheduleFind(table, count, 24 * 60));
+}
+
+void test_next_later_today(void)
+{
+  link_time now = at(6, 0);
+  uint16_t next;
+  TEST_ASSERT_EQUAL(1, linkScheduleNext(table, count, &now, &next));
+  TEST_ASSERT_EQUAL(12 * 60, next);
+}
+
+void test_next_running_interval_rule(void)
+{
+  table[0].every = 15;
+  table[0].end = 7 * 60;
+  link_time now = at(6, 20);
+  uint16_t next;
+  TEST_ASSERT_EQUAL(0, linkScheduleNext(table, count, &now, &next)); // started before now, runs again at 06:30
+  TEST_ASSERT_EQUAL(6 * 60 + 30, next);
+}
+
+void test_next_skips_to_the_next_running_day(void)
+{
+  table[0].days = LINK_DAY(2); // Monday
+  table[1].start &= ~LINK_SLOT_ON;
+  table[2].start &= ~LINK_SLOT_ON;
+  link_time now = at(6, 0);
+  uint16_t next;
+  TEST_ASSERT_EQUAL(0, linkScheduleNext(table, count, &now, &next));
+  TEST_ASSERT_EQUAL(2 * 24 * 60 + 6 * 60, next);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_step_only_sets_the_cursor);
+  RUN_TEST(test_fires_on_the_minute);
+  RUN_TEST(test_catch_up_after_missed_minutes);
+  RUN_TEST(test_same_minute_fires_once);
+  RUN_TEST(test_small_step_back_does_not_fire_again);
+  RUN_TEST(test_step_forward_skips);
+  RUN_TEST(test_large_step_back_restarts);
+  RUN_TEST(test_catch_up_replays_every_missed_rule);
+  RUN_TEST(test_midnight_wrap_uses_yesterday);
+  RUN_TEST(test_midnight_wrap_wrong_day);
+  RUN_TEST(test_midnight_wrap_fires_both_days);
+  RUN_TEST(test_interval_rule_catch_up);
+  RUN_TEST(test_disabled_rule_never_fires);
+  RUN_TEST(test_find_returns_the_first_rule_at_or_after);
+  RUN_TEST(test_next_later_today);
+  RUN_TEST(test_next_running_interval_rule);
+  RUN_TEST(test_next_skips_to_the_next_running_day);
+  return UNITY_END();
+}
@@ -0,0 +1,46 @@
+# PlatformIO pre script: builds data/ (the LittleFS image) from web/
+#
+# Every file in web/ is gzipped into data/<name>.gz, or copied as it is
+# when gzip saves less than GZIP_MIN_SAVING (the PNG). data/etag.txt gets
+# one line per file, "<name> <etag> <gzip|->", the firmware serves from it
+# with Content-Encoding and answers If-None-Match with 304. The ETag is
+# a hash of the uncompressed content, so it only changes with the file.
+
+Import("env")
+
+import gzip
+import hashlib
+import os
+
+GZIP_MIN_SAVING = 0.05
+
+
+def build_web(source, target):
+    os.makedirs(target, exist_ok=True)
+    for name in os.listdir(target):
+        os.remove(os.path.join(target, name))
+    lines = []
+    total_raw = total_sent = 0
+    print("web: file                       raw     sent")
+    for name in sorted(os.listdir(source)):
+        with open(os.path.join(source, name), "rb") as f:
+            raw = f.read()
+        packed = gzip.compress(raw, 9, mtime=0)  # same input, same bytes
+        etag = '"' + hashlib.sha1(raw).hexdigest()[:16] + '"'
+        if len(packed) <= len(raw) * (1 - GZIP_MIN_SAVING):
+            body, stored, encoding = packed, name + ".gz", "gzip"
+        else:
+            body, stored, encoding = raw, name, "-"
+        with open(os.path.join(target, stored), "wb") as f:
+            f.write(body)
+        lines.append("%s %s %s\n" % (name, etag, encoding))
+        total_raw += len(raw)
+        total_sent += len(body)
+        print("web: %-24s %8d %8d  %3d%%" % (name, len(raw), len(body), 100 * len(body) // max(len(raw), 1)))
+    with open(os.path.join(target, "etag.txt"), "w") as f:
+        f.writelines(lines)
+    print("web: %-24s %8d %8d  %3d%%, %d bytes less per first load" %
+          ("total", total_raw, total_sent, 100 * total_sent // max(total_raw, 1), total_raw - total_sent))
+
+
+build_web(os.path.join(env.subst("$PROJECT_DIR"), "web"), env.subst("$PROJECT_DATA_DIR"))
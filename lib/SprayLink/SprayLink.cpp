@@ -0,0 +1,442 @@
+#include "SprayLink.h"
+#include <string.h>
+
+struct link_field_def
+{
+  uint8_t offset, size;
+};
+
+static const link_field_def linkFields[LINK_FIELD_COUNT] = {
+    {offsetof(link_settings, threshold), sizeof(int16_t)},
+    {offsetof(link_settings, duration), sizeof(uint8_t)},
+    {offsetof(link_settings, resolution), sizeof(uint8_t)},
+    {offsetof(link_settings, roles), sizeof(uint8_t)},
+    {offsetof(link_settings, hysteresis), sizeof(int16_t)},
+    {offsetof(link_settings, minOn), sizeof(uint16_t)},
+    {offsetof(link_settings, minOff), sizeof(uint16_t)},
+    {offsetof(link_settings, filter), sizeof(uint8_t)},
+    {offsetof(link_settings, policy), sizeof(uint8_t)},
+    {offsetof(link_settings, deadline), sizeof(uint8_t)}};
+
+uint8_t linkCrc8(const uint8_t *data, uint8_t len)
+{ // Dallas/Maxim CRC8, same polynomial the DS18B20 scratchpad uses
+  uint8_t crc = 0;
+  while (len--)
+  {
+    uint8_t in = *data++;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      uint8_t mix = (crc ^ in) & 0x01;
+      crc >>= 1;
+      if (mix)
+      {
+        crc ^= 0x8C;
+      }
+      in >>= 1;
+    }
+  }
+  return crc;
+}
+
+uint8_t linkPack(uint8_t *frame, uint8_t type, uint8_t seq, const void *payload, uint8_t len)
+{
+  if (len > LINK_MAX_PAYLOAD)
+  {
+    return 0;
+  }
+  frame[0] = LINK_VERSION;
+  frame[1] = type;
+  frame[2] = seq;
+  frame[3] = len;
+  memcpy(frame + LINK_HEADER_SIZE, payload, len);
+  frame[LINK_HEADER_SIZE + len] = linkCrc8(frame, LINK_HEADER_SIZE + len);
+  return LINK_FRAME_SIZE(len);
+}
+
+link_result linkParse(const uint8_t *buffer, uint8_t n, link_frame *frame)
+{
+  if (n > LINK_MAX_FRAME)
+  {
+    return LINK_OVERFLOW;
+  }
+  if (n < LINK_FRAME_SIZE(0))
+  {
+    return LINK_SHORT;
+  }
+  if (buffer[0] != LINK_VERSION)
+  {
+    return LINK_BAD_VERSION;
+  }
+  uint8_t len = buffer[3];
+  if (len > LINK_MAX_PAYLOAD || n < LINK_FRAME_SIZE(len))
+  {
+    return LINK_SHORT;
+  }
+  if (linkCrc8(buffer, LINK_HEADER_SIZE + len) != buffer[LINK_HEADER_SIZE + len])
+  {
+    return LINK_BAD_CRC;
+  }
+  frame->version = buffer[0];
+  frame->type = buffer[1];
+  frame->seq = buffer[2];
+  frame->len = len;
+  frame->payload = buffer + LINK_HEADER_SIZE;
+  return LINK_OK;
+}
+
+uint8_t linkPackDelta(uint8_t *payload, const link_settings *now, const link_settings *last)
+{
+  const uint8_t *src = (const uint8_t *)now;
+  const uint8_t *old = (const uint8_t *)last;
+  uint16_t mask = 0;
+  uint8_t len = 2;
+  for (uint8_t i = 0; i < LINK_FIELD_COUNT; i++)
+  {
+    const link_field_def *field = &linkFields[i];
+    if (memcmp(src + field->offset, old + field->offset, field->size) != 0)
+    {
+      memcpy(payload + len, src + field->offset, field->size);
+      len += field->size;
+      mask |= 1 << i;
+    }
+  }
+  if (mask == 0)
+  {
+    return 0;
+  }
+  payload[0] = mask & 0xFF;
+  payload[1] = mask >> 8;
+  return len;
+}
+
+bool linkApplyDelta(link_settings *settings, const uint8_t *payload, uint8_t len)
+{
+  if (len < 2)
+  {
+    return false;
+  }
+  uint16_t mask = payload[0] | (payload[1] << 8);
+  if (mask == 0 || mask >> LINK_FIELD_COUNT)
+  {
+    return false;
+  }
+  uint8_t expected = 2;
+  for (uint8_t i = 0; i < LINK_FIELD_COUNT; i++)
+  {
+    if (mask & (1 << i))
+    {
+      expected += linkFields[i].size;
+    }
+  }
+  if (expected != len)
+  {
+    return false;
+  }
+  uint8_t *dst = (uint8_t *)settings;
+  const uint8_t *src = payload + 2;
+  for (uint8_t i = 0; i < LINK_FIELD_COUNT; i++)
+  {
+    if (mask & (1 << i))
+    {
+      memcpy(dst + linkFields[i].offset, src, linkFields[i].size);
+      src += linkFields[i].size;
+    }
+  }
+  return true;
+}
+
+bool linkPointerValid(const link_pointer *pointer)
+{
+  return pointer->len > 0 && pointer->len < LINK_MAX_PAYLOAD && pointer->reg + pointer->len <= sizeof(link_registers);
+}
+
+uint8_t linkScheduleCrc(const link_slot *slots, uint8_t count)
+{
+  return linkCrc8((const uint8_t *)slots, count * sizeof(link_slot));
+}
+
+uint8_t linkPackSchedule(uint8_t *payload, const link_slot *slots, uint8_t count, uint8_t first)
+{
+  link_schedule_header header = {count, first, linkScheduleCrc(slots, count)};
+  uint8_t n = (first < count) ? count - first : 0;
+  if (n > LINK_SLOTS_PER_CHUNK)
+  {
+    n = LINK_SLOTS_PER_CHUNK;
+  }
+  memcpy(payload, &header, sizeof(header));
+  memcpy(payload + sizeof(header), slots + first, n * sizeof(link_slot));
+  return sizeof(header) + n * sizeof(link_slot);
+}
+
+bool linkApplySchedule(link_schedule_rx *rx, link_slot *slots, uint8_t *count, const uint8_t *payload, uint8_t len)
+{
+  if (len < sizeof(link_schedule_header) || (len - sizeof(link_schedule_header)) % sizeof(link_slot) != 0)
+  {
+    return false;
+  }
+  link_schedule_header header;
+  memcpy(&header, payload, sizeof(header));
+  uint8_t n = (len - sizeof(header)) / sizeof(link_slot);
+  if (header.count > LINK_MAX_SLOTS || header.first + n > header.count)
+  {
+    return false;
+  }
+  if (header.first % LINK_SLOTS_PER_CHUNK != 0 || (n != LINK_SLOTS_PER_CHUNK && header.first + n != header.count) ||
+      (n == 0 && header.count != 0))
+  { // chunks as linkPackSchedule() cuts them, so each one has its own bit
+    return false;
+  }
+  if (rx->count != header.count || rx->crc != header.crc)
+  { // another table, chunks of the last one don't count towards it
+    rx->count = header.count;
+    rx->crc = header.crc;
+    rx->chunks = 0;
+  }
+  memcpy(slots + header.first, payload + sizeof(header), n * sizeof(link_slot));
+  rx->chunks |= 1 << (header.first / LINK_SLOTS_PER_CHUNK);
+  uint8_t all = (1 << LINK_SCHEDULE_CHUNKS(header.count)) - 1;
+  if (rx->chunks == all && linkScheduleCrc(slots, header.count) == header.crc)
+  {
+    *count = header.count;
+    rx->chunks = 0; // a resend of the same table starts over
+  }
+  return true;
+}
+
+link_slot linkSlot(uint16_t minute, bool on)
+{
+  link_slot slot = {(uint16_t)(minute | (on ? LINK_SLOT_ON : 0)), minute, 0, LINK_DAYS_ALL, 0, 0};
+  return slot;
+}
+
+uint8_t linkDaysInMonth(uint8_t month, uint8_t year)
+{
+  if (month == 2)
+  {
+    return (year % 4 == 0) ? 29 : 28;
+  }
+  return (month == 4 || month == 6 || month == 9 || month == 11) ? 30 : 31;
+}
+
+uint8_t linkDayOfWeek(uint8_t day, uint8_t month, uint8_t year)
+{ // Sakamoto's method
+  static const uint8_t offset[12] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+  uint16_t y = 2000 + year - (month < 3);
+  return (y + y / 4 - y / 100 + y / 400 + offset[(month - 1) % 12] + day) % 7 + 1;
+}
+
+static void linkDayStep(link_time *time, bool forward)
+{ // move the date of time one day, the clock fields are left alone
+  if (forward)
+  {
+    time->dayOfWeek = time->dayOfWeek % 7 + 1;
+    if (++time->dayOfMonth > linkDaysInMonth(time->month, time->year))
+    {
+      time->dayOfMonth = 1;
+      if (++time->month > 12)
+      {
+        time->month = 1;
+        time->year = (time->year + 1) % 100;
+      }
+    }
+    return;
+  }
+  time->dayOfWeek = (time->dayOfWeek + 5) % 7 + 1;
+  if (--time->dayOfMonth == 0)
+  {
+    if (--time->month == 0)
+    {
+      time->month = 12;
+      time->year = (time->year + 99) % 100;
+    }
+    time->dayOfMonth = linkDaysInMonth(time->month, time->year);
+  }
+}
+
+static bool linkSlotRuns(const link_slot *slot, const link_time *day)
+{ // enabled, on this weekday and inside its season
+  if (!(slot->start & LINK_SLOT_ON) || !(slot->days & LINK_DAY(day->dayOfWeek)))
+  {
+    return false;
+  }
+  if (slot->from == 0)
+  {
+    return true;
+  }
+  uint16_t date = LINK_DATE(day->month, day->dayOfMonth);
+  if (slot->from <= slot->to)
+  {
+    return date >= slot->from && date <= slot->to;
+  }
+  return date >= slot->from || date <= slot->to;
+}
+
+static int16_t linkSlotEnd(const link_slot *slot)
+{ // minute of the last run, a rule without a valid interval runs once
+  int16_t start = LINK_SLOT_MINUTE(*slot);
+  return (slot->every > 0 && slot->end > start && slot->end < LINK_MINUTES_PER_DAY) ? slot->end : start;
+}
+
+static int16_t linkSlotLatest(const link_slot *slot, int16_t from, int16_t to)
+{ // latest run with from < minute <= to, -1 if none
+  int16_t start = LINK_SLOT_MINUTE(*slot);
+  int16_t last = linkSlotEnd(slot);
+  if (last > to)
+  {
+    last = to;
+  }
+  if (last < start)
+  {
+    return -1;
+  }
+  if (slot->every > 0)
+  {
+    last = start + (last - start) / slot->every * slot->every;
+  }
+  return (last > from) ? last : -1;
+}
+
+static int16_t linkSlotFirst(const link_slot *slot, int16_t from)
+{ // first run at or after from, -1 if none
+  int16_t start = LINK_SLOT_MINUTE(*slot);
+  int16_t end = linkSlotEnd(slot);
+  if (from <= start)
+  {
+    return start;
+  }
+  if (from > end)
+  {
+    return -1;
+  }
+  int16_t run = start + (from - start + slot->every - 1) / slot->every * slot->every;
+  return (run <= end) ? run : -1;
+}
+
+void linkScheduleSort(link_slot *slots, uint8_t count)
+{
+  for (uint8_t i = 1; i < count; i++)
+  {
+    link_slot slot = slots[i];
+    uint8_t j = i;
+    while (j > 0 && LINK_SLOT_MINUTE(slots[j - 1]) > LINK_SLOT_MINUTE(slot))
+    {
+      slots[j] = slots[j - 1];
+      j--;
+    }
+    slots[j] = slot;
+  }
+}
+
+uint8_t linkScheduleFind(const link_slot *slots, uint8_t count, uint16_t minute)
+{
+  uint8_t low = 0, high = count;
+  while (low < high)
+  {
+    uint8_t mid = (low + high) / 2;
+    if (LINK_SLOT_MINUTE(slots[mid]) < minute)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+static uint16_t linkScheduleRuns(const link_slot *slots, uint8_t count, const link_time *day, int16_t from, int16_t to)
+{ // rules with a run on day with from < minute <= to, bit n = slots[n]
+  uint16_t due = 0;
+  for (uint8_t i = linkScheduleFind(slots, count, to + 1); i-- > 0;)
+  { // rules starting after to are never looked at, a once-a-day rule at or before from is over,
+    // only interval rules that started earlier can still have a run in the window
+    if (slots[i].every == 0 && (int16_t)LINK_SLOT_MINUTE(slots[i]) <= from)
+    {
+      continue;
+    }
+    if (linkSlotRuns(&slots[i], day) && linkSlotLatest(&slots[i], from, to) >= 0)
+    {
+      due |= 1U << i;
+    }
+  }
+  return due;
+}
+
+uint16_t linkScheduleDue(const link_slot *slots, uint8_t count, uint16_t last, const link_time *now)
+{
+  uint16_t minute = now->hour * 60 + now->minute;
+  if (minute >= last)
+  {
+    return linkScheduleRuns(slots, count, now, last, minute);
+  }
+  link_time yesterday = *now;
+  linkDayStep(&yesterday, false);
+  return linkScheduleRuns(slots, count, &yesterday, last, LINK_MINUTES_PER_DAY - 1) |
+         linkScheduleRuns(slots, count, now, -1, minute);
+}
+
+uint16_t linkScheduleStep(link_schedule_cursor *cursor, const link_slot *slots, uint8_t count, const link_time *now)
+{
+  uint16_t minute = now->hour * 60 + now->minute;
+  if (!cursor->valid)
+  { // nothing is known about the minutes before the first call
+    cursor->last = minute;
+    cursor->valid = true;
+    return 0;
+  }
+  uint16_t ahead = (minute + LINK_MINUTES_PER_DAY - cursor->last) % LINK_MINUTES_PER_DAY;
+  if (ahead == 0 || ahead > LINK_MINUTES_PER_DAY - LINK_CATCHUP_MAX)
+  { // same minute, or the clock was corrected backwards a little: keep the cursor so nothing fires twice
+    return 0;
+  }
+  uint16_t last = cursor->last;
+  cursor->last = minute;
+  if (ahead > LINK_CATCHUP_MAX)
+  { // clock set forward, the skipped slots never really came due
+    return 0;
+  }
+  return linkScheduleDue(slots, count, last, now);
+}
+
+uint8_t linkScheduleNext(const link_slot *slots, uint8_t count, const link_time *now, uint16_t *at)
+{
+  link_time day = *now;
+  int16_t from = now->hour * 60 + now->minute + 1;
+  for (uint8_t ahead = 0; ahead <= LINK_NEXT_DAYS; ahead++)
+  {
+    uint8_t next = count;
+    int16_t nextRun = LINK_MINUTES_PER_DAY;
+    uint8_t first = linkScheduleFind(slots, count, from);
+    for (uint8_t i = 0; i < first; i++)
+    { // started before from, only an interval rule can still run today
+      int16_t run = (slots[i].every > 0 && linkSlotRuns(&slots[i], &day)) ? linkSlotFirst(&slots[i], from) : -1;
+      if (run >= 0 && run < nextRun)
+      {
+        next = i;
+        nextRun = run;
+      }
+    }
+    for (uint8_t i = first; i < count; i++)
+    { // sorted, the first rule that runs on day is the earliest start
+      if ((int16_t)LINK_SLOT_MINUTE(slots[i]) >= nextRun)
+      {
+        break;
+      }
+      if (linkSlotRuns(&slots[i], &day))
+      {
+        next = i;
+        nextRun = LINK_SLOT_MINUTE(slots[i]);
+        break;
+      }
+    }
+    if (next < count)
+    {
+      *at = ahead * LINK_MINUTES_PER_DAY + nextRun;
+      return next;
+    }
+    linkDayStep(&day, true);
+    from = 0;
+  }
+  return count;
+}
@@ -0,0 +1,366 @@
+#ifndef SPRAY_LINK_H
+#define SPRAY_LINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+I2C frame shared by the main (ESP8266) and aux (ATmega328P) board
+
+byte 0          protocol version
+byte 1          message type
+byte 2          sequence number
+byte 3          payload length
+byte 4..4+len   payload, little endian packed struct
+byte 4+len      CRC8 (Dallas/Maxim) over byte 0..4+len-1
+
+A frame never exceeds the 32 byte AVR Wire buffer.
+
+The aux board answers reads from a register map (link_registers). The
+host writes a LINK_MSG_POINTER frame with the first register and the
+length, then requests LINK_FRAME_SIZE(len + 1) bytes and gets back a
+LINK_MSG_REGISTERS frame holding the register address and the data.
+
+The spray schedule is too big for one frame, the host sends it as
+LINK_MSG_SCHEDULE chunks that each carry the table size and a CRC over
+the whole table. The aux board swaps the new table in only once every
+chunk has arrived and the CRC matches, a mix of old and new slots that
+happens to match the CRC is not enough. The count and CRC of the table in
+use are in the register map, the host reads them on its heartbeat and
+resends the chunks only when they differ from its own table.
+*/
+
+#define LINK_VERSION 9
+#define LINK_HEADER_SIZE 4
+#define LINK_MAX_FRAME 32
+#define LINK_MAX_PAYLOAD (LINK_MAX_FRAME - LINK_HEADER_SIZE - 1)
+#define LINK_FRAME_SIZE(len) (LINK_HEADER_SIZE + (len) + 1)
+
+// Temperatures are fixed point centi degrees celcius (int16_t), 3050 = 30.50 C
+#define LINK_TEMP_INVALID INT16_MIN
+
+#define LINK_MAX_SENSORS 4 // DS18B20 on the aux OneWire bus
+
+/*
+Sensor roles, 2 bits per sensor in link_settings.roles (sensor 0 in bits 0-1)
+MAX      control temperature is the highest of these
+AVERAGE  control temperature is the average of these (or the max group, whichever is higher)
+ZONE     triggers a spray on its own when over the threshold
+OFF      read and reported, not used for control
+*/
+#define LINK_ROLE_MAX 0
+#define LINK_ROLE_AVERAGE 1
+#define LINK_ROLE_ZONE 2
+#define LINK_ROLE_OFF 3
+#define LINK_ROLE(roles, sensor) (((roles) >> ((sensor) * 2)) & 0x03)
+
+// Temperature controller tuning limits, the host clamps before sending
+#define LINK_FILTER_MAX 4       // EMA weight down to 1/16 per conversion
+#define LINK_HYSTERESIS_MAX 500 // centi C
+#define LINK_MIN_TIME_MAX 600   // s, minimum valve on/off time
+#define LINK_DURATION_MIN 1     // minutes a scheduled spray lasts at least
+#define LINK_DURATION_MAX 60
+
+/*
+Spray job policy, flags in link_settings.policy. Without MERGE or PREEMPT
+a new job waits its turn (defer).
+MERGE       a timer job extends a running or waiting timer job instead of queueing behind it
+PREEMPT     a job of higher priority stops the running one, which goes back in the queue
+TIMER_FIRST timer jobs outrank temperature jobs, by default temperature comes first
+*/
+#define LINK_POLICY_MERGE 0x01
+#define LINK_POLICY_PREEMPT 0x02
+#define LINK_POLICY_TIMER_FIRST 0x04
+
+#define LINK_MAX_JOBS 4 // waiting spray jobs on the aux board
+
+enum link_type : uint8_t
+{
+  LINK_MSG_SETTINGS = 0x01, // main -> aux, control settings
+  LINK_MSG_TIME = 0x02,     // main -> aux, RTC snapshot
+  LINK_MSG_DELTA = 0x03,    // main -> aux, changed settings fields only
+  LINK_MSG_POINTER = 0x04,  // main -> aux, register pointer for the next read
+  LINK_MSG_SCHEDULE = 0x05, // main -> aux, one chunk of the spray schedule
+  LINK_MSG_REGISTERS = 0x81 // aux -> main, register address + register data
+};
+
+enum link_result : uint8_t
+{
+  LINK_OK = 0,
+  LINK_SHORT,       // less bytes than header + crc, or than the declared length
+  LINK_OVERFLOW,    // more bytes than a frame can hold
+  LINK_BAD_VERSION, // unknown protocol version
+  LINK_BAD_CRC,     // checksum mismatch
+  LINK_BAD_TYPE     // valid frame, but not the expected type or payload size
+};
+
+struct link_settings
+{
+  int16_t threshold; // centi C
+  uint8_t duration;   // spray duration in minutes
+  uint8_t resolution; // DS18B20 resolution, 9-12 bit
+  uint8_t roles;      // LINK_ROLE_* per sensor
+  int16_t hysteresis; // centi C below the threshold before the temperature valve closes again
+  uint16_t minOn;     // s the temperature valve stays open at least
+  uint16_t minOff;    // s the temperature valve stays closed at least
+  uint8_t filter;     // EMA weight 1/2^filter on every sensor, 0 = unfiltered
+  uint8_t policy;     // LINK_POLICY_* flags
+  uint8_t deadline;   // minutes a job may wait for its turn before it is dropped, 0 = no limit
+} __attribute__((packed));
+
+/*
+Delta payload: 16 bit field mask followed by the raw bytes of every
+field whose bit is set, in field order.
+*/
+
+enum link_field : uint8_t
+{
+  LINK_FIELD_THRESHOLD = 0,
+  LINK_FIELD_DURATION,
+  LINK_FIELD_RESOLUTION,
+  LINK_FIELD_ROLES,
+  LINK_FIELD_HYSTERESIS,
+  LINK_FIELD_MIN_ON,
+  LINK_FIELD_MIN_OFF,
+  LINK_FIELD_FILTER,
+  LINK_FIELD_POLICY,
+  LINK_FIELD_DEADLINE,
+  LINK_FIELD_COUNT
+};
+
+/*
+Schedule rule, 10 bytes. A rule runs once at its start minute, or with
+every set from start to end every N minutes. It only runs on the
+weekdays in days and, when from is set, between the from and to dates
+(inclusive, a season may wrap past new year). A table holds up to
+LINK_MAX_SLOTS rules sorted by start minute.
+*/
+
+struct link_slot
+{
+  uint16_t start; // bit 15 enabled, bits 0-10 minute of the day of the first run
+  uint16_t end;   // minute of the day of the last run, only used with every
+  uint8_t every;  // minutes between runs, 0 = once at start
+  uint8_t days;   // LINK_DAY() mask
+  uint16_t from;  // LINK_DATE() the season starts, 0 = all year
+  uint16_t to;    // LINK_DATE() the season ends
+} __attribute__((packed));
+
+#define LINK_MAX_SLOTS 16
+#define LINK_SLOT_ON 0x8000
+#define LINK_SLOT_MINUTE(slot) ((slot).start & 0x07FF)
+#define LINK_MINUTES_PER_DAY 1440
+#define LINK_DAY(dayOfWeek) (1 << ((dayOfWeek) - 1)) // DS3231 day of the week, 1 = Sunday
+#define LINK_DAYS_ALL 0x7F
+#define LINK_DATE(month, day) ((uint16_t)((month) << 5 | (day)))
+#define LINK_DATE_MONTH(date) ((date) >> 5)
+#define LINK_DATE_DAY(date) ((date) & 0x1F)
+#define LINK_NEXT_DAYS 7 // days linkScheduleNext() looks ahead
+#define LINK_CATCHUP_MAX 5 // minutes, a longer step forward is a clock change, not a missed tick
+
+/*
+Schedule evaluation runs on intervals, not on minute equality: each call
+covers (last evaluated minute, now], so a minute skipped by a dropped
+time frame or a blocked loop is caught up and a minute seen twice fires
+only once. Small steps backwards wait until the clock passes the last
+evaluated minute again. Minutes before midnight are checked against the
+weekday and date of the day before. Every rule with a run in the window
+is reported, so a catch-up replays each missed spray, not just the last.
+*/
+
+struct link_schedule_cursor
+{
+  uint16_t last; // minute of the day evaluated up to
+  bool valid;    // false until the first evaluation
+};
+
+struct link_schedule_header
+{
+  uint8_t count; // slots in the whole table
+  uint8_t first; // index of the first slot in this chunk
+  uint8_t crc;   // CRC8 over all count slots
+} __attribute__((packed));
+
+struct link_table
+{
+  uint8_t count; // slots in the table in use
+  uint8_t crc;   // CRC8 over all count slots
+} __attribute__((packed));
+
+#define LINK_SLOTS_PER_CHUNK ((LINK_MAX_PAYLOAD - sizeof(link_schedule_header)) / sizeof(link_slot))
+#define LINK_SCHEDULE_CHUNKS(count) ((count) == 0 ? 1 : ((count) + LINK_SLOTS_PER_CHUNK - 1) / LINK_SLOTS_PER_CHUNK)
+
+struct link_schedule_rx
+{ // receiver side of a chunked table, starts over when count or CRC change
+  uint8_t count;
+  uint8_t crc;
+  uint8_t chunks; // bit n set = chunk n arrived
+};
+
+static_assert(LINK_SCHEDULE_CHUNKS(LINK_MAX_SLOTS) <= 8, "link_schedule_rx.chunks has a bit per chunk");
+static_assert(LINK_MAX_SLOTS <= 16, "linkScheduleDue() has a bit per rule");
+
+struct link_time
+{ // same layout as the DS3231 registers 00h-06h after BCD decoding
+  uint8_t second, minute, hour, dayOfWeek, dayOfMonth, month, year;
+} __attribute__((packed));
+
+struct link_pointer
+{
+  uint8_t reg, len;
+} __attribute__((packed));
+
+#define LINK_FAULT_SENSOR 0x01 // no reading from the DS18B20
+#define LINK_FAULT_LINK 0x02   // no valid frame from the host for a while, running degraded
+
+#define LINK_VALVE_TEMP 0x01  // temperature valve open
+#define LINK_VALVE_TIMER 0x02 // timer valve open
+#define LINK_VALVE_QUEUE 0x04 // spray jobs waiting
+#define LINK_VALVE_BUSY 0x08  // relay sequence running
+
+enum link_trigger : uint8_t
+{
+  LINK_TRIGGER_NONE = 0,
+  LINK_TRIGGER_TEMP,
+  LINK_TRIGGER_ZONE1,                                    // + sensor index, a ZONE sensor over the threshold
+  LINK_TRIGGER_SLOT1 = LINK_TRIGGER_ZONE1 + LINK_MAX_SENSORS // + schedule slot index
+};
+
+enum link_sensor : uint8_t
+{
+  LINK_SENSOR_OK = 0,
+  LINK_SENSOR_MISSING,     // no DS18B20 found on the bus
+  LINK_SENSOR_DISCONNECTED, // found at boot, stopped answering
+  LINK_SENSOR_CRC           // scratchpad failed its CRC
+};
+
+struct link_status
+{
+  uint8_t faults;      // LINK_FAULT_* flags
+  int16_t celcius;     // latest temperature, centi C or LINK_TEMP_INVALID
+  uint8_t valves;      // LINK_VALVE_* flags
+  uint16_t remaining;  // seconds left on the running timed job
+  uint8_t trigger;     // link_trigger of the running or last job
+  uint8_t sensorError; // link_sensor
+  uint32_t uptime;     // seconds since aux boot
+} __attribute__((packed));
+
+enum link_state : uint8_t
+{
+  LINK_STATE_OK = 0,
+  LINK_STATE_DEGRADED // host silent, clock runs from millis()
+};
+
+struct link_zones
+{
+  uint8_t count;                      // sensors found on the bus
+  int16_t celcius[LINK_MAX_SENSORS]; // per sensor, centi C or LINK_TEMP_INVALID
+} __attribute__((packed));
+
+struct link_health
+{
+  uint8_t state;     // link_state
+  uint16_t age;      // seconds since the last valid frame
+  uint16_t received; // valid frames
+  uint16_t missed;   // frames lost, from sequence number gaps
+  uint16_t rejected; // frames dropped as corrupt, short or unknown
+  uint8_t outages;   // times degraded mode was entered
+} __attribute__((packed));
+
+struct link_job
+{
+  uint8_t source;     // link_trigger that raised the job
+  uint8_t priority;   // higher runs first
+  uint16_t duration;  // s still to run, 0 = as long as the temperature stays over the threshold
+  uint8_t wait;       // minutes left before the job is dropped, 0xFF = no limit
+} __attribute__((packed));
+
+struct link_queue
+{
+  uint8_t count;   // waiting jobs, highest priority first
+  uint8_t dropped; // jobs dropped on a full queue or a passed deadline, wraps
+  link_job jobs[LINK_MAX_JOBS];
+} __attribute__((packed));
+
+struct link_registers
+{
+  uint8_t version;        // 0x00 aux firmware version
+  link_status status;     // 0x01 status record
+  link_zones zones;       // 0x0D per sensor temperatures
+  link_health health;     // 0x16 link watchdog counters
+  link_queue queue;       // 0x20 waiting spray jobs
+  link_settings settings; // 0x36 settings in use, read only
+  link_table schedule;    // 0x44 schedule table in use
+} __attribute__((packed));
+
+#define LINK_REG(field) ((uint8_t)offsetof(link_registers, field))
+#define LINK_REG_SPAN(first, last) ((uint8_t)(LINK_REG(last) + sizeof(((link_registers *)0)->last) - LINK_REG(first)))
+
+struct link_frame
+{
+  uint8_t version, type, seq, len;
+  const uint8_t *payload; // points into the received buffer, no copy
+};
+
+uint8_t linkCrc8(const uint8_t *data, uint8_t len);
+
+// Pack a payload into frame, returns the frame size or 0 if it does not fit
+uint8_t linkPack(uint8_t *frame, uint8_t type, uint8_t seq, const void *payload, uint8_t len);
+
+// Validate a received buffer and point frame->payload at its payload
+link_result linkParse(const uint8_t *buffer, uint8_t n, link_frame *frame);
+
+// Pack the fields of now that differ from last, returns the payload size or 0 if nothing changed
+uint8_t linkPackDelta(uint8_t *payload, const link_settings *now, const link_settings *last);
+
+// Apply a delta payload onto settings, false if the payload is malformed (settings untouched)
+bool linkApplyDelta(link_settings *settings, const uint8_t *payload, uint8_t len);
+
+// Check a pointer frame against the register map, false if it reads past the end or won't fit a frame
+bool linkPointerValid(const link_pointer *pointer);
+
+// CRC8 over a whole schedule table, as carried in link_schedule_header and link_table
+uint8_t linkScheduleCrc(const link_slot *slots, uint8_t count);
+
+// Pack the chunk of slots starting at first, returns the payload size
+uint8_t linkPackSchedule(uint8_t *payload, const link_slot *slots, uint8_t count, uint8_t first);
+
+// Store a schedule chunk into slots, false if malformed. *count is set once every chunk of the table is in and its CRC matches
+bool linkApplySchedule(link_schedule_rx *rx, link_slot *slots, uint8_t *count, const uint8_t *payload, uint8_t len);
+
+// A rule that runs once a day at minute, every day of the year
+link_slot linkSlot(uint16_t minute, bool on);
+
+// Days in month (1-12) of year (0-99, 2000-2099)
+uint8_t linkDaysInMonth(uint8_t month, uint8_t year);
+
+// DS3231 day of the week of a date, 1 = Sunday
+uint8_t linkDayOfWeek(uint8_t day, uint8_t month, uint8_t year);
+
+// Insertion sort by start minute, tables are short and mostly sorted already
+void linkScheduleSort(link_slot *slots, uint8_t count);
+
+// Index of the first rule starting at or after minute, count if there is none
+uint8_t linkScheduleFind(const link_slot *slots, uint8_t count, uint16_t minute);
+
+// Rules with a run in (last, now], wrapping past midnight, bit n = slots[n], 0 if none
+uint16_t linkScheduleDue(const link_slot *slots, uint8_t count, uint16_t last, const link_time *now);
+
+// Advance the cursor to now, returns the rules that became due as linkScheduleDue() does
+uint16_t linkScheduleStep(link_schedule_cursor *cursor, const link_slot *slots, uint8_t count, const link_time *now);
+
+// Rule with the next run after now within LINK_NEXT_DAYS, count if none. *at is minutes from today 00:00
+uint8_t linkScheduleNext(const link_slot *slots, uint8_t count, const link_time *now, uint16_t *at);
+
+// Typed view on a parsed frame, NULL if type or payload size does not match
+template <typename T>
+const T *linkPayload(const link_frame *frame, uint8_t type)
+{
+  if (frame->type != type || frame->len != sizeof(T))
+  {
+    return NULL;
+  }
+  return (const T *)frame->payload;
+}
+
+#endif